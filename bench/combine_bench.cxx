@@ -0,0 +1,168 @@
+#include "tree.h"
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <random>
+
+/*
+ * 多线程写同一棵树的基准测试：对比每个操作抢一次锁与平面合并（FlatCombiner）两种前端
+ * 对每个线程数：先用固定种子加载数据，各线程再对均匀分布的随机键执行指定数目的操作（插入或覆盖/删除/查找），
+ * 输出两种前端的吞吐量，合并前端另外输出平均批大小与每次下降作用的操作数
+ *
+ * 用法：bpt_combine_bench [--threads 1,4,16,32] [--records 100000] [--ops 100000] [--degree 64]
+ *                         [--read-ratio 0] [--delete-ratio 0.3] [--slots 128] [--seed 42]
+ *       --ops 为每个线程的操作数
+ */
+
+struct CombineConfig{
+    vector<int> threads = {1, 4, 16, 32};
+    uint64_t records = 100000;
+    uint64_t ops = 100000;
+    int degree = 64;
+    double read_ratio = 0;
+    double delete_ratio = 0.3;
+    int slots = 128;
+    uint64_t seed = 42;
+};
+
+static vector<string> split_list(const string &s)
+{
+    vector<string> items;
+    std::stringstream ss(s);
+    string item;
+    while(std::getline(ss, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool parse_args(int argc, char **argv, CombineConfig &cfg)
+{
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(i + 1 >= argc){
+            std::cerr << "Missing value for option: " << arg << endl;
+            return false;
+        }
+        string val = argv[++i];
+        if(arg == "--threads"){
+            cfg.threads.clear();
+            for(auto &t : split_list(val))
+                cfg.threads.push_back(std::max(1, std::stoi(t)));
+        }
+        else if(arg == "--records")
+            cfg.records = std::stoull(val);
+        else if(arg == "--ops")
+            cfg.ops = std::stoull(val);
+        else if(arg == "--degree")
+            cfg.degree = std::stoi(val);
+        else if(arg == "--read-ratio")
+            cfg.read_ratio = std::stod(val);
+        else if(arg == "--delete-ratio")
+            cfg.delete_ratio = std::stod(val);
+        else if(arg == "--slots")
+            cfg.slots = std::stoi(val);
+        else if(arg == "--seed")
+            cfg.seed = std::stoull(val);
+        else{
+            std::cerr << "Unknown option: " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 加载records条数据，键为0..records-1打乱后的顺序
+static void load(BPlusTree &bpt, const CombineConfig &cfg)
+{
+    vector<key_type> keys(cfg.records);
+    for(uint64_t i = 0; i < cfg.records; i++)
+        keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(cfg.seed));
+    for(auto key : keys)
+        bpt.upsert(key, "V" + std::to_string(key));
+}
+
+// 一个线程的操作序列：键在加载范围的两倍内均匀分布，删除与插入大致平衡
+template<class Front>
+static void run_thread(Front &front, const CombineConfig &cfg, int tid)
+{
+    std::mt19937_64 rng(cfg.seed * 1000 + tid);
+    std::uniform_real_distribution<double> coin(0, 1);
+    key_type range = std::max<uint64_t>(cfg.records * 2, 1);
+    value_type value;
+    for(uint64_t i = 0; i < cfg.ops; i++){
+        key_type key = rng() % range;
+        double c = coin(rng);
+        if(c < cfg.read_ratio)
+            front.search(key, value);
+        else if(c < cfg.read_ratio + cfg.delete_ratio)
+            front.remove(key);
+        else
+            front.upsert(key, "V" + std::to_string(key));
+    }
+}
+
+// 每个操作抢一次锁的前端
+struct LockedFront{
+    BPlusTree &bpt;
+    std::mutex mtx;
+
+    explicit LockedFront(BPlusTree &bpt) : bpt(bpt) {}
+    bool upsert(const key_type &key, const value_type &value){ std::lock_guard<std::mutex> lock(mtx); return bpt.upsert(key, value); }
+    bool remove(const key_type &key){ std::lock_guard<std::mutex> lock(mtx); return bpt.deleteKeyValue(key); }
+    bool search(const key_type &key, value_type &value){ std::lock_guard<std::mutex> lock(mtx); return bpt.searchKeyValue(key, value); }
+};
+
+template<class Front>
+static double run_threads(Front &front, const CombineConfig &cfg, int threads)
+{
+    vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for(int t = 0; t < threads; t++)
+        workers.emplace_back([&front, &cfg, t]{ run_thread(front, cfg, t); });
+    for(auto &w : workers)
+        w.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    CombineConfig cfg;
+    if(!parse_args(argc, argv, cfg))
+        return 1;
+
+    cout << "hardware threads=" << std::thread::hardware_concurrency() << " records=" << cfg.records
+         << " ops/thread=" << cfg.ops << " degree=" << cfg.degree << " read_ratio=" << cfg.read_ratio
+         << " delete_ratio=" << cfg.delete_ratio << endl;
+
+    // 删除不存在的键、查找未命中属于负载本身的行为，屏蔽逐条的错误输出
+    std::cerr.setstate(std::ios::badbit);
+
+    for(auto threads : cfg.threads){
+        double total = (double)cfg.ops * threads;
+
+        BPlusTree locked_tree(cfg.degree);
+        load(locked_tree, cfg);
+        LockedFront locked(locked_tree);
+        double locked_seconds = run_threads(locked, cfg, threads);
+
+        BPlusTree combined_tree(cfg.degree);
+        load(combined_tree, cfg);
+        FlatCombiner combiner(combined_tree, cfg.slots);
+        double combined_seconds = run_threads(combiner, cfg, threads);
+        FlatCombinerStats stats = combiner.getStats();
+
+        cout << std::left << "threads=" << std::setw(4) << threads << std::right << std::fixed << std::setprecision(0)
+             << " lock-per-op=" << total / locked_seconds << " ops/s"
+             << " combining=" << total / combined_seconds << " ops/s"
+             << std::setprecision(2) << " speedup=" << locked_seconds / combined_seconds << "x"
+             << " avg_batch=" << stats.avgBatch()
+             << " ops/descent=" << (stats.descents ? (double)stats.ops / stats.descents : 0) << endl;
+        cout << std::defaultfloat << std::setprecision(6);
+    }
+
+    std::cerr.clear();
+    return 0;
+}
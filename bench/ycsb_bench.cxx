@@ -0,0 +1,341 @@
+#include "tree.h"
+#include "workload.h"
+#include <sstream>
+#include <iomanip>
+#include <limits>
+
+/*
+ * YCSB 风格的基准测试
+ * 对每一组（度数, 数据量, 负载）：用固定种子打乱顺序加载数据，再运行指定数目的混合操作，
+ * 输出吞吐量与各操作的延迟百分位数，并可写入 JSON 文件以便跨版本比较。
+ *
+ * 用法：bpt_bench [--workloads A,B,C,D,E,F,churn] [--degrees 4,16,64] [--records 100000]
+ *                 [--ops 100000] [--value-size 16] [--seed 42] [--json result.json]
+ *                 [--write-buffer 0]      （大于0时开启写优化模式，值为每个内部节点的缓冲容量）
+ *                 [--hot-cache 0]         （大于0时开启热点键缓存，值为缓存的槽数）
+ *                 [--learned-index 0]     （大于0时在加载后开启学习索引，值为预测误差上限）
+ *                 [--aggregate-threads 0] （大于0时在运行后对全部键做一次单线程与多线程聚合，值为线程数）
+ *                 [--tier-interval 0]     （大于0时开启冷热分层，值为后台扫描的间隔毫秒数）
+ *                 [--tier-spill FILE]     （冷叶子压缩后写入此文件）
+ *                 [--inner-degree 0]      （大于0时内部节点使用此度数，--degrees只作用于叶子）
+ */
+
+struct BenchConfig{
+    vector<string> workloads = {"A", "B", "C", "D", "E", "F"};
+    vector<int> degrees = {4, 16, 64};
+    vector<uint64_t> records = {100000};
+    uint64_t ops = 100000;
+    int value_size = 16;
+    uint64_t seed = 42;
+    int write_buffer = 0;
+    uint64_t hot_cache = 0;
+    int learned_index = 0;
+    int aggregate_threads = 0;
+    int tier_interval = 0;
+    string tier_spill;
+    int inner_degree = 0;
+    string json_file;
+};
+
+struct BenchResult{
+    string workload;
+    int degree;
+    uint64_t records;
+    double load_seconds;
+    double run_seconds;
+    uint64_t ops;
+    LatencyHistogram overall;
+    LatencyHistogram per_op[WOP_COUNT];
+    HotCacheStats cache;
+    LearnedIndexStats learned;
+    uint64_t aggregate_keys = 0;
+    double aggregate_serial_seconds = 0;
+    double aggregate_parallel_seconds = 0;
+    TierStats tier;
+};
+
+static vector<string> split_list(const string &s)
+{
+    vector<string> items;
+    std::stringstream ss(s);
+    string item;
+    while(std::getline(ss, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool parse_args(int argc, char **argv, BenchConfig &cfg)
+{
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(i + 1 >= argc){
+            std::cerr << "Missing value for option: " << arg << endl;
+            return false;
+        }
+        string val = argv[++i];
+        if(arg == "--workloads")
+            cfg.workloads = split_list(val);
+        else if(arg == "--degrees"){
+            cfg.degrees.clear();
+            for(auto &d : split_list(val))
+                cfg.degrees.push_back(std::stoi(d));
+        }
+        else if(arg == "--records"){
+            cfg.records.clear();
+            for(auto &n : split_list(val))
+                cfg.records.push_back(std::stoull(n));
+        }
+        else if(arg == "--ops")
+            cfg.ops = std::stoull(val);
+        else if(arg == "--value-size")
+            cfg.value_size = std::stoi(val);
+        else if(arg == "--seed")
+            cfg.seed = std::stoull(val);
+        else if(arg == "--write-buffer")
+            cfg.write_buffer = std::stoi(val);
+        else if(arg == "--hot-cache")
+            cfg.hot_cache = std::stoull(val);
+        else if(arg == "--learned-index")
+            cfg.learned_index = std::stoi(val);
+        else if(arg == "--aggregate-threads")
+            cfg.aggregate_threads = std::stoi(val);
+        else if(arg == "--tier-interval")
+            cfg.tier_interval = std::stoi(val);
+        else if(arg == "--tier-spill")
+            cfg.tier_spill = val;
+        else if(arg == "--inner-degree")
+            cfg.inner_degree = std::stoi(val);
+        else if(arg == "--json")
+            cfg.json_file = val;
+        else{
+            std::cerr << "Unknown option: " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 生成定长的value
+static value_type make_value(key_type key, int size)
+{
+    value_type v = "V" + std::to_string(key);
+    v.resize(size > (int)v.size() ? size : v.size(), 'x');
+    return v;
+}
+
+static BenchResult run_one(const BenchConfig &cfg, const WorkloadSpec &spec, int degree, uint64_t records)
+{
+    using clock = std::chrono::steady_clock;
+
+    BenchResult r;
+    r.workload = spec.name;
+    r.degree = degree;
+    r.records = records;
+    r.ops = cfg.ops;
+
+    BPlusTree bpt(degree);
+    if(cfg.inner_degree > 0)
+        bpt.set_degrees(degree, cfg.inner_degree);
+    if(cfg.write_buffer > 0)
+        bpt.set_write_optimized(true, cfg.write_buffer);
+    if(cfg.hot_cache > 0)
+        bpt.enable_hot_cache(cfg.hot_cache);
+    if(cfg.tier_interval > 0){
+        TieringConfig tc;
+        tc.interval_ms = cfg.tier_interval;
+        tc.spill_file = cfg.tier_spill;
+        bpt.enable_tiering(tc);
+    }
+    Workload wl(spec, records, cfg.seed);
+
+    // 加载阶段
+    auto start = clock::now();
+    for(uint64_t i = 0; i < records; i++){
+        key_type key = wl.loadKey(i);
+        bpt.insertKeyValue(key, make_value(key, cfg.value_size));
+    }
+    r.load_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    if(cfg.learned_index > 0)   // 按加载完的叶子训练，不计入加载时间
+        bpt.enable_learned_index(cfg.learned_index);
+
+    // 运行阶段：操作参数在计时之外准备
+    value_type v;
+    vector<std::pair<key_type, value_type>> scan_result;
+    auto run_start = clock::now();
+    for(uint64_t i = 0; i < cfg.ops; i++){
+        WorkloadOp op = wl.nextOp();
+        if(op == WOP_DELETE && wl.liveCount() <= 1)     // 保留最后一条记录，读与更新才有键可选
+            op = WOP_READ;
+        key_type key;
+        int scan_len = 0;
+        switch(op){
+        case WOP_INSERT: key = wl.nextInsertKey(); break;
+        case WOP_DELETE: key = wl.nextDeleteKey(); break;
+        case WOP_SCAN:   key = wl.nextReadKey(); scan_len = wl.nextScanLength(); break;
+        default:         key = wl.nextReadKey(); break;
+        }
+        value_type new_value = make_value(key, cfg.value_size);
+
+        auto op_start = clock::now();
+        switch(op){
+        case WOP_READ:   bpt.searchKeyValue(key, v); break;
+        case WOP_UPDATE: bpt.modifyKeyValue(key, new_value); break;
+        case WOP_INSERT: bpt.insertKeyValue(key, new_value); break;
+        case WOP_SCAN:   bpt.scanKeyValue(key, scan_len, scan_result); break;
+        case WOP_DELETE: bpt.deleteKeyValue(key); break;
+        case WOP_RMW:       // 一次下降完成读-改-写
+            bpt.update(key, [&](value_type &old){ v = old; old = new_value; });
+            break;
+        default: break;
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - op_start).count();
+        r.per_op[op].record(ns);
+        r.overall.record(ns);
+    }
+    r.run_seconds = std::chrono::duration<double>(clock::now() - run_start).count();
+    r.cache = bpt.getHotCacheStats();
+    r.learned = bpt.getLearnedIndexStats();
+    r.tier = bpt.getTierStats();
+
+    // 全范围聚合：先单线程，再用线程池按子树并行
+    if(cfg.aggregate_threads > 0){
+        const key_type lo = std::numeric_limits<key_type>::min(), hi = std::numeric_limits<key_type>::max();
+        auto agg_start = clock::now();
+        RangeAggregate serial = bpt.aggregateRange(lo, hi);
+        r.aggregate_serial_seconds = std::chrono::duration<double>(clock::now() - agg_start).count();
+
+        ThreadPool pool(cfg.aggregate_threads);
+        agg_start = clock::now();
+        RangeAggregate parallel = bpt.parallelAggregate(lo, hi, pool);
+        r.aggregate_parallel_seconds = std::chrono::duration<double>(clock::now() - agg_start).count();
+        if(parallel.count != serial.count || parallel.sum != serial.sum)
+            cout << "Parallel aggregate mismatch: " << parallel.count << " vs " << serial.count << " keys" << endl;
+        r.aggregate_keys = serial.count;
+    }
+    return r;
+}
+
+static void print_result(const BenchResult &r)
+{
+    cout << std::left << std::setw(7) << r.workload
+         << " degree=" << std::setw(4) << r.degree
+         << " records=" << std::setw(10) << r.records
+         << " load=" << std::fixed << std::setprecision(3) << r.load_seconds << "s"
+         << " throughput=" << std::setprecision(0) << r.ops / r.run_seconds << " ops/s"
+         << " p50=" << r.overall.percentile(50) << "ns"
+         << " p99=" << r.overall.percentile(99) << "ns"
+         << " p999=" << r.overall.percentile(99.9) << "ns" << endl;
+    cout << std::right << std::defaultfloat << std::setprecision(6);
+    if(r.cache.capacity > 0){
+        cout << "        ";
+        r.cache.print(cout);
+    }
+    if(r.learned.epsilon > 0){
+        cout << "        ";
+        r.learned.print(cout);
+    }
+    if(r.tier.sweeps > 0){
+        cout << "        ";
+        r.tier.print(cout);
+    }
+    if(r.aggregate_keys > 0){
+        cout << "        Range aggregate: keys=" << r.aggregate_keys
+             << " serial=" << r.aggregate_serial_seconds * 1000 << "ms"
+             << " parallel=" << r.aggregate_parallel_seconds * 1000 << "ms"
+             << " speedup=" << r.aggregate_serial_seconds / r.aggregate_parallel_seconds << "x"
+             << " simd=" << (simd_kernels_enabled() ? "avx2" : "off") << endl;
+    }
+}
+
+static void write_latency_json(std::ostream &os, const LatencyHistogram &h)
+{
+    os << "{\"count\": " << h.count()
+       << ", \"mean_ns\": " << h.mean()
+       << ", \"p50_ns\": " << h.percentile(50)
+       << ", \"p99_ns\": " << h.percentile(99)
+       << ", \"p999_ns\": " << h.percentile(99.9)
+       << ", \"max_ns\": " << h.max() << "}";
+}
+
+static void write_json(const string &file_name, const BenchConfig &cfg, const vector<BenchResult> &results)
+{
+    std::ofstream out(file_name);
+    if(!out.is_open()){
+        std::cerr << "Failed to open json file: " << file_name << endl;
+        return;
+    }
+
+    out << "{\n  \"seed\": " << cfg.seed
+        << ",\n  \"ops\": " << cfg.ops
+        << ",\n  \"value_size\": " << cfg.value_size
+        << ",\n  \"write_buffer\": " << cfg.write_buffer
+        << ",\n  \"hot_cache\": " << cfg.hot_cache
+        << ",\n  \"learned_index\": " << cfg.learned_index
+        << ",\n  \"aggregate_threads\": " << cfg.aggregate_threads
+        << ",\n  \"tier_interval\": " << cfg.tier_interval
+        << ",\n  \"inner_degree\": " << cfg.inner_degree
+        << ",\n  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); i++){
+        const BenchResult &r = results[i];
+        out << "    {\"workload\": \"" << r.workload << "\""
+            << ", \"degree\": " << r.degree
+            << ", \"records\": " << r.records
+            << ", \"load_seconds\": " << r.load_seconds
+            << ", \"run_seconds\": " << r.run_seconds
+            << ", \"throughput_ops\": " << r.ops / r.run_seconds
+            << ", \"cache_hit_rate\": " << r.cache.hitRate()
+            << ", \"cache_memory_bytes\": " << r.cache.memory_bytes
+            << ", \"learned_model_bytes\": " << r.learned.model_bytes + r.learned.directory_bytes
+            << ", \"inner_node_bytes\": " << r.learned.inner_bytes
+            << ", \"aggregate_serial_seconds\": " << r.aggregate_serial_seconds
+            << ", \"aggregate_parallel_seconds\": " << r.aggregate_parallel_seconds
+            << ", \"resident_bytes\": " << r.tier.residentBytes()
+            << ", \"cold_bytes\": " << r.tier.cold_bytes
+            << ", \"spilled_bytes\": " << r.tier.spilled_bytes
+            << ",\n     \"latency\": ";
+        write_latency_json(out, r.overall);
+        out << ",\n     \"ops\": {";
+        bool first = true;
+        for(int op = 0; op < WOP_COUNT; op++){
+            if(r.per_op[op].count() == 0)
+                continue;
+            out << (first ? "" : ", ") << "\"" << workloadOpName((WorkloadOp)op) << "\": ";
+            write_latency_json(out, r.per_op[op]);
+            first = false;
+        }
+        out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    cout << "Results written to: " << file_name << endl;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig cfg;
+    if(!parse_args(argc, argv, cfg))
+        return 1;
+
+    // 负载中可能出现查找/删除失败，屏蔽逐条的错误输出
+    std::cerr.setstate(std::ios::badbit);
+
+    vector<BenchResult> results;
+    for(auto records : cfg.records){
+        for(auto degree : cfg.degrees){
+            for(auto &name : cfg.workloads){
+                WorkloadSpec spec;
+                if(!WorkloadSpec::byName(name, spec)){
+                    cout << "Unknown workload: " << name << endl;
+                    continue;
+                }
+                results.push_back(run_one(cfg, spec, degree, records));
+                print_result(results.back());
+            }
+        }
+    }
+
+    std::cerr.clear();
+    if(!cfg.json_file.empty())
+        write_json(cfg.json_file, cfg, results);
+    return 0;
+}
@@ -23,6 +23,20 @@ int main(int argc, char **argv)
 
     test_insertion(bpt, 1000000, true);
     test_deletion(bpt, 10000);
+    test_split_join(bpt, 500000);
+    test_range_deletion(bpt, 100000, 200000);
+    test_restructure(bpt, 32, 64, 256);
+    test_mapped_startup(bpt, "mapped.db", 500000);
+    {
+        AsyncIO io;
+        MappedTree mt;
+        if(mt.open("mapped.db"))
+            test_async_search(mt, io, 10000, 1000000);
+    }
+
+#ifdef BPT_ENABLE_STATS
+    BPlusTree::getStats().print(cout);
+#endif
 
     if(updated)
         bpt.save_to_file();
@@ -0,0 +1,134 @@
+#ifndef __ASYNC_IO_H__
+#define __ASYNC_IO_H__
+
+#include "utils.h"
+#include "thread_pool.h"
+#include <cstdint>
+#include <ostream>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <streambuf>
+
+/*
+ * 异步批量文件I/O：读、写、sync_file_range与预读请求先排队，submit()一次交出一批，poll()收割完成的请求
+ * 首选io_uring（直接用系统调用，不依赖liburing）：一批请求只进一次内核；io_uring不可用时（老内核、seccomp禁用、
+ * 不支持要用的操作）退回线程池，由工作线程执行pread/pwrite；运行中io_uring_enter出错时，在途的请求以错误完成，之后也改用线程池
+ * 两种后端下完成回调都只在调用poll()/drain()的线程上执行，回调中可以继续发起新请求，
+ * 一个线程就能让许多查找同时等待I/O（续延式接口）
+ * 同时在途的请求数不超过队列深度，多出来的留在队列中，有请求完成后再交出
+ */
+
+struct AsyncIOStats{
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t syncs = 0;             // sync_file_range请求数
+    uint64_t prefetches = 0;        // 预读请求数
+    uint64_t batches = 0;           // 交出请求的次数（io_uring下即io_uring_enter的提交次数）
+    uint64_t completed = 0;
+    uint64_t errors = 0;            // 结果为负（-errno）的请求数
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    size_t max_inflight = 0;        // 同时在途请求数的峰值
+    bool uring = false;
+
+    void print(std::ostream &os) const;
+};
+
+class AsyncIO{
+public:
+    // 请求的结果：读写的字节数，或-errno
+    typedef std::function<void(int result)> Completion;
+
+    explicit AsyncIO(int depth = 128, bool use_uring = true, int fallback_threads = 8);
+    ~AsyncIO();
+
+    bool usingUring() const;
+    int depth() const;
+
+    void read(int fd, void *buf, uint32_t length, uint64_t offset, Completion done = nullptr);
+    void write(int fd, const void *buf, uint32_t length, uint64_t offset, Completion done = nullptr);
+    void syncRange(int fd, uint64_t offset, uint32_t length, Completion done = nullptr);
+    void prefetch(int fd, uint64_t offset, uint32_t length);
+
+    int submit();
+    int poll(int min_complete = 0);
+    void drain();
+    size_t outstanding() const;
+
+    AsyncIOStats getStats() const;
+    void resetStats();
+
+private:
+    enum OpType{ OP_READ, OP_WRITE, OP_SYNC, OP_PREFETCH };
+    struct Request{
+        OpType op;
+        int fd;
+        void *buf;
+        uint32_t length;
+        uint64_t offset;
+        Completion done;
+    };
+
+    int queue_depth;
+    int pool_threads;
+    std::queue<Request> queued;         // 已排队、还没交出的请求
+    vector<Request> slots;              // 在途请求，下标即提交时带上的user_data
+    vector<int> free_slots;
+    size_t inflight = 0;
+    vector<std::pair<int, int>> finished;   // 已完成的(槽, 结果)
+
+    // io_uring
+    int ring_fd = -1;
+    void *sq_ring = nullptr, *cq_ring = nullptr, *sqe_mem = nullptr;
+    size_t sq_ring_bytes = 0, cq_ring_bytes = 0, sqe_bytes = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    void *cqes = nullptr;
+    unsigned sq_entries = 0;
+
+    // 线程池后端：工作线程把完成的请求放进done_list
+    std::unique_ptr<ThreadPool> pool;
+    std::mutex done_mtx;
+    std::condition_variable done_cv;
+    vector<std::pair<int, int>> done_list;
+
+    AsyncIOStats counters;
+
+    void enqueue(Request &&req);
+    bool setup_uring(unsigned entries);
+    bool probe_ops();
+    void abandon_uring(int err);
+    void teardown_uring();
+    int submit_uring(int min_complete);
+    void reap_uring();
+    void run_on_pool(int slot);
+};
+
+// 按大块异步写文件的输出流缓冲：一块写满就交出去，同时往下一块里写，序列化与写盘重叠
+class AsyncFileWriter : public std::streambuf{
+public:
+    AsyncFileWriter(AsyncIO &io, int fd, size_t chunk_bytes = 1 << 20, int chunks = 4);
+    ~AsyncFileWriter();
+
+    bool finish();
+    uint64_t bytesWritten() const;
+
+protected:
+    int_type overflow(int_type ch) override;
+
+private:
+    AsyncIO &io;
+    int fd;
+    uint64_t offset = 0;
+    vector<vector<char>> buffers;
+    vector<char> busy;                  // 对应的块正在写
+    int current = 0;
+    bool failed = false;
+    bool finished = false;
+
+    void flush_current();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __BLOCK_SCAN_H__
+#define __BLOCK_SCAN_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <ostream>
+
+/*
+ * 块扫描与向量化过滤内核
+ * 块扫描按叶子交出区间内连续的一段键/值（LeafSpan），调用者直接在数组上做批量计算，不用逐个getKey
+ * 过滤内核对一段键求谓词：x86上运行时检测到AVX2时一次比较8个键，生成位掩码后用查表重排写出下标，
+ * 否则走无分支的标量循环（编译器可自动向量化）；聚合内核在同一趟中算出满足谓词的键数、和、最小与最大值
+ */
+
+// 一个叶子中落在扫描区间内的连续一段，键升序
+struct LeafSpan{
+    const key_type *keys;
+    const value_type *values;
+    int size;
+};
+
+enum FilterOp{
+    FILTER_EQ,          // key == a
+    FILTER_NE,          // key != a
+    FILTER_LT,          // key < a
+    FILTER_LE,          // key <= a
+    FILTER_GT,          // key > a
+    FILTER_GE,          // key >= a
+    FILTER_BETWEEN,     // a <= key <= b
+    FILTER_MASK         // (key & a) == b，例如按低位抽样或按位分片
+};
+
+struct KeyPredicate{
+    FilterOp op;
+    key_type a;
+    key_type b = 0;
+
+    bool test(const key_type &key) const;
+};
+
+struct RangeAggregate{
+    uint64_t count = 0;
+    int64_t sum = 0;
+    key_type min = 0;       // count为0时min/max无意义
+    key_type max = 0;
+
+    void merge(const RangeAggregate &other);
+    void print(std::ostream &os) const;
+};
+
+int filter_keys(const key_type *keys, int n, const KeyPredicate &pred, int *selection);
+int64_t sum_keys(const key_type *keys, int n);
+void aggregate_keys(const key_type *keys, int n, const KeyPredicate *pred, RangeAggregate &agg);
+bool simd_kernels_enabled();
+
+#endif
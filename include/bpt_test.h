@@ -2,12 +2,19 @@
 #define __BPT_TEST_H__
 
 #include "tree.h"
+#include "mapped_tree.h"
 
 int test_insertion(BPlusTree &bpt, int numInsertions, bool is_random);
 double test_search(BPlusTree &bpt, int num);
 double test_deletion(BPlusTree &bpt, int num);
+int test_range_deletion(BPlusTree &bpt, int lo, int hi);
+int test_split_join(BPlusTree &bpt, int key);
+int test_range_aggregate(BPlusTree &bpt, int threads);
 int test_serialization(BPlusTree &bpt);
 int test_deserialization(BPlusTree &bpt, string file_name);
+int test_restructure(BPlusTree &bpt, int leaf_degree, int nonleaf_degree, int step_leaves);
+int test_mapped_startup(BPlusTree &bpt, string file_name, const key_type &key);
+int test_async_search(MappedTree &mt, AsyncIO &io, int num, int max_key);
 void test_bplustree(BPlusTree &bpt, int degree, bool clear);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef __FLAT_COMBINE_H__
+#define __FLAT_COMBINE_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <ostream>
+#include <atomic>
+
+/*
+ * 平面合并（flat combining）写前端：多个线程对同一棵树做修改时，不再每个操作抢一次锁，
+ * 而是把操作发布到各自的槽中；抢到合并权的那个线程把所有槽里待执行的操作收成一批，按键排序后一起作用到树上，
+ * 再把结果逐个写回槽中，其余线程只在自己的槽上等待结果
+ * 排好序的一批里落在同一个叶子上的一串操作只下降一次（BPlusTree::applyBatch），
+ * 树本身、锁与热点数据只在合并者一个线程的缓存中来回，不在所有写线程之间搬运
+ * 同一批中的操作是并发发出的，彼此之间的先后任意；同一个线程的操作按发出顺序生效
+ */
+
+class BPlusTree;
+
+enum CombinedOpType{
+    CMB_INSERT,
+    CMB_UPSERT,
+    CMB_DELETE,
+    CMB_SEARCH
+};
+
+// 一个发布出来的操作及其结果
+struct CombinedOp{
+    key_type key;
+    CombinedOpType type;
+    const value_type *value;    // 插入/插入或覆盖的value
+    value_type *out;            // 查找结果
+    bool result;
+};
+
+struct FlatCombinerStats{
+    uint64_t ops = 0;
+    uint64_t batches = 0;       // 作用到树上的批数
+    uint64_t descents = 0;      // 作用各批时从根下降的次数，退回单个操作路径的操作各算一次
+    uint64_t max_batch = 0;
+    uint64_t combines = 0;      // 拿到合并权的次数
+
+    double avgBatch() const;
+    void print(std::ostream &os) const;
+};
+
+class FlatCombiner{
+public:
+    explicit FlatCombiner(BPlusTree &tree, int slots = 128);
+
+    bool insert(const key_type &key, const value_type &value);
+    bool upsert(const key_type &key, const value_type &value);
+    bool remove(const key_type &key);
+    bool search(const key_type &key, value_type &value);
+
+    FlatCombinerStats getStats();
+    void resetStats();
+
+private:
+    // 槽的状态：空闲 -> 属主填写 -> 待执行 -> 已完成 -> 空闲
+    enum SlotState{ SLOT_FREE, SLOT_OWNED, SLOT_PENDING, SLOT_DONE };
+    struct alignas(64) Slot{        // 一个槽占一整条缓存行，属主与合并者之外没有人碰它
+        std::atomic<int> state{SLOT_FREE};
+        CombinedOp op;
+    };
+
+    BPlusTree &tree;
+    vector<Slot> slots;
+    std::atomic<int> used_slots{0};     // 用到过的槽数，合并者只扫描这个范围
+    alignas(64) std::atomic<bool> combining{false};
+    vector<CombinedOp*> batch;          // 以下只由合并者访问
+    vector<Slot*> batch_slots;
+    FlatCombinerStats stats;
+
+    bool execute(CombinedOp &op);
+    Slot *claim_slot();
+    void combine();
+    bool try_lock();
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __HOT_CACHE_H__
+#define __HOT_CACHE_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <ostream>
+
+/*
+ * 热点键查找缓存：放在树前面的定长哈希表，命中时探测一个桶即可返回value，不用从根下降
+ * 每个桶对齐到一条缓存行，8个槽的键、有效位和访问位都在这一行内；value放在平行的数组中
+ * 缓存的是value的副本而不是叶子中的位置，叶子分裂、借键、合并搬动条目时缓存不受影响，
+ * 只需在value被改写或键被删除时更新或作废对应的槽
+ * 准入：未命中时在频率草图（4行count-min，计数饱和于15，累计一定次数后全部减半）中计数，
+ * 桶满时按CLOCK选出被替换者，只有新键的估计频率高于它才替换，偶发的冷键冲不掉热点
+ * 注意查找也会修改缓存状态，多个线程并发查找时需要由调用者加互斥锁
+ */
+
+struct HotCacheStats{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t admissions = 0;        // 放入缓存的次数
+    uint64_t rejections = 0;        // 被频率草图拒绝的次数
+    uint64_t invalidations = 0;     // 因删除而作废的槽数
+    size_t entries = 0;             // 当前有效的槽数
+    size_t capacity = 0;            // 总槽数
+    size_t memory_bytes = 0;        // 桶、value数组（含value的堆内存）与频率草图占用的内存
+
+    double hitRate() const;
+    void print(std::ostream &os) const;
+};
+
+class HotCache{
+public:
+    static const int WAYS = 8;      // 每个桶的槽数
+
+    explicit HotCache(size_t capacity);
+
+    bool lookup(const key_type &key, value_type &value);
+    void admit(const key_type &key, const value_type &value);
+    void update(const key_type &key, const value_type &value);
+    void invalidate(const key_type &key);
+    void invalidateRange(const key_type &lo, const key_type &hi);
+    void clear();
+
+    HotCacheStats getStats() const;
+    void resetStats();
+
+private:
+    static const int SKETCH_ROWS = 4;
+    static const uint8_t SKETCH_MAX = 15;
+
+    struct alignas(64) Bucket{
+        key_type keys[WAYS];
+        uint8_t valid = 0;          // 每一位表示对应的槽是否有效
+        uint8_t referenced = 0;     // CLOCK访问位：命中时置位
+        uint8_t hand = 0;           // CLOCK指针
+    };
+
+    vector<Bucket> buckets;
+    vector<value_type> values;      // 第b个桶第w个槽的value在 b*WAYS+w 处
+    size_t bucket_mask = 0;
+
+    vector<uint8_t> sketch;         // SKETCH_ROWS行，每行sketch_mask+1个计数器
+    size_t sketch_mask = 0;
+    uint64_t sketch_additions = 0;
+    uint64_t sketch_period = 0;     // 累计计数达到此值时所有计数器减半
+
+    HotCacheStats counters;
+
+    static uint64_t hash(const key_type &key);
+    Bucket &bucket_of(uint64_t h);
+    int find_way(const Bucket &b, const key_type &key) const;
+    void increment(uint64_t h);
+    int frequency(uint64_t h) const;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __LEARNED_INDEX_H__
+#define __LEARNED_INDEX_H__
+
+#include "utils.h"
+#include "node.h"
+#include <cstdint>
+#include <ostream>
+
+/*
+ * 学习型内部索引（整数键）：用分段线性模型代替内部节点，直接预测key所在的叶子
+ * 训练时遍历内部节点，以父节点中的索引键作为每个叶子的下界，按叶子序号拟合若干线段（收缩锥算法），
+ * 保证每个叶子的预测序号与真实序号相差不超过epsilon；查找时先二分找到线段，
+ * 再在预测位置两侧的窗口内二分叶子的最小键，得到目标叶子
+ *
+ * 叶子和叶子链表保持不变。训练之后：
+ *   叶子分裂产生的新叶子不在目录中，从预测的叶子沿next_leaf往右走几步即可到达（增量路径）
+ *   叶子被释放（合并、范围删除、清空）后目录中可能有悬空指针，整个模型作废，查找退回从根下降
+ * 往右多走的步数与作废期间退回下降的次数记为“欠账”，欠账超过叶子数时重新训练，训练的开销由此均摊
+ */
+
+struct LearnedIndexStats{
+    int epsilon = 0;
+    size_t leaves = 0;              // 训练时的叶子数
+    size_t segments = 0;            // 线段数
+    size_t model_bytes = 0;         // 线段占用的内存
+    size_t directory_bytes = 0;     // 叶子目录（最小键与叶子指针）占用的内存
+    size_t inner_bytes = 0;         // 作为对比：树中所有内部节点占用的内存
+    uint64_t lookups = 0;           // 由模型定位的查找次数
+    uint64_t window_misses = 0;     // 误差窗口内没找到、改为在整个目录中二分的次数
+    uint64_t delta_steps = 0;       // 沿next_leaf往右多走的步数
+    uint64_t fallbacks = 0;         // 退回从根下降的次数：模型已作废，或预测的叶子最小键在训练后变大了
+    uint64_t trainings = 0;         // 训练次数（含开启时的第一次）
+
+    void print(std::ostream &os) const;
+};
+
+class LearnedIndex{
+public:
+    explicit LearnedIndex(int epsilon);
+
+    void train(BPlusNode *root);
+    BPlusNode *findLeaf(const key_type &key);
+    void invalidate();
+    bool needsRetrain() const;
+
+    LearnedIndexStats getStats() const;
+    void resetStats();
+
+private:
+    struct Segment{
+        key_type key;       // 线段中第一个叶子的最小键
+        int first;          // 线段中第一个叶子的序号
+        double slope;
+    };
+
+    int epsilon;
+    bool stale = true;
+    uint64_t debt = 0;
+
+    vector<key_type> first_keys;    // 各叶子训练时的下界
+    vector<BPlusNode*> leaves;
+    vector<key_type> segment_keys;  // 各线段的起始键，单独存放便于二分
+    vector<Segment> segments;
+
+    LearnedIndexStats counters;
+
+    void collect(BPlusNode *node, const key_type &lower);
+    int predict(const key_type &key);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef __MAPPED_TREE_H__
+#define __MAPPED_TREE_H__
+
+#include "utils.h"
+#include "async_io.h"
+#include <cstdint>
+#include <ostream>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+class BPlusTree;
+
+/*
+ * 映射到文件的持久化B+树：节点是文件中定长的页，彼此用页号而不是指针引用，整个文件用mmap映射
+ * 打开时只映射文件、校验超级块，不读入任何节点；查找用到哪一页，才由缺页中断从文件读入哪一页，启动时间与数据量无关
+ * 一致性用影子分页（写时复制）：已提交的页从不原地修改，修改路径上的页先复制到新页再改，本事务内复制出的页可以继续原地修改
+ * commit时先msync所有新页，再把新根写入两个超级块中较旧的那个并msync；任何时刻崩溃，重新打开时都取校验和正确、
+ * 序号较大的超级块，恢复到最近一次提交。被替换下来的旧页在提交后才进入空闲链表
+ * 叶子之间没有链表指针（写时复制时无法同时更新左邻居），范围查询沿下降时的路径栈回溯
+ * 删除只在节点删空时把它从父节点摘掉，不做借与合并
+ * 挂上AsyncIO后：searchAsync/searchBatch沿路径下降，不在页缓存中的页异步读入，同时缺同一页的查找共用一次读取，一个线程可以同时挂起许多查找；
+ * 范围查询按还需要的键数预读父节点中后面的几个兄弟叶子；commit把本事务写过的页合并成连续的段成批写回
+ */
+
+// 异步查找的结果：读页失败（出错或读到的不足一页）与键不存在区分开
+enum LookupStatus{
+    LOOKUP_FOUND,
+    LOOKUP_ABSENT,
+    LOOKUP_ERROR
+};
+
+struct MappedTreeStats{
+    uint64_t keys = 0;
+    uint64_t height = 0;
+    uint64_t pages = 0;             // 文件中已使用的页数（含空闲页与超级块）
+    uint64_t free_pages = 0;        // 空闲链表中的页数
+    uint64_t file_bytes = 0;
+    uint64_t commits = 0;           // 本次打开以来的提交次数
+    uint64_t cow_copies = 0;        // 本次打开以来因写时复制而复制的页数
+    uint64_t page_reads = 0;        // 异步查找发起的页读取数
+    uint64_t read_errors = 0;       // 异步查找中失败的页读取数
+    uint64_t prefetched_pages = 0;  // 范围查询预读的叶子页数
+
+    void print(std::ostream &os) const;
+};
+
+class MappedTree{
+public:
+    static const int PAGE_SIZE = 4096;
+    static const int MAX_VALUE = 1024;     // value的最大长度，保证一页至少能放下3个键值对
+
+    MappedTree() = default;
+    ~MappedTree();
+
+    bool open(const string &file_name);
+    bool commit();
+    void close();
+    bool isOpen() const;
+
+    bool search(const key_type &key, value_type &value);
+    bool put(const key_type &key, const value_type &value);
+    bool remove(const key_type &key);
+    int scan(const key_type &start_key, int count, vector<std::pair<key_type, value_type>> &result);
+    int importFrom(BPlusTree &bpt);
+
+    // 查找完成时调用：查找的结果，以及找到的value
+    typedef std::function<void(LookupStatus status, const value_type &value)> LookupDone;
+    void set_async_io(AsyncIO *io, int prefetch_leaves = 8);
+    void searchAsync(const key_type &key, LookupDone done);
+    int searchBatch(const vector<key_type> &keys, vector<std::pair<LookupStatus, value_type>> &results);
+
+    MappedTreeStats getStats();
+
+private:
+    struct Meta{
+        uint64_t magic;
+        uint64_t seq;           // 提交序号
+        uint64_t root;          // 根节点的页号，0表示空树
+        uint64_t height;
+        uint64_t page_count;    // 已使用的页数，之后的页还未分配过
+        uint64_t free_head;     // 空闲链表的第一页，0表示没有
+        uint64_t free_count;
+        uint64_t key_count;
+        uint64_t checksum;      // 前面各字段的校验和
+    };
+    struct PageHeader{
+        uint8_t leaf;
+        uint8_t unused;
+        uint16_t count;         // 键数
+        uint16_t data_start;    // 叶子：value区的起点，value从页尾往前放
+        uint16_t unused2;
+        uint64_t txn;           // 写入此页的事务号；等于当前事务号的页可以原地修改
+    };
+    struct LeafSlot{
+        key_type key;
+        uint16_t offset;
+        uint16_t length;
+    };
+    struct AsyncLookup{
+        key_type key;
+        LookupDone done;
+    };
+    // 一次在途的页读取：同时缺同一页的查找都挂在这里，读完后一起往下走
+    struct PageFetch{
+        std::unique_ptr<char[]> buf;
+        vector<std::shared_ptr<AsyncLookup>> waiters;
+    };
+
+    static const int INNER_MAX_KEYS = (PAGE_SIZE - sizeof(PageHeader) - sizeof(uint64_t)) / (sizeof(key_type) + sizeof(uint64_t));
+    static const int CHILDREN_OFFSET = PAGE_SIZE - (INNER_MAX_KEYS + 1) * sizeof(uint64_t);
+    static const int FREELIST_CAP = (PAGE_SIZE - sizeof(PageHeader) - 2 * sizeof(uint64_t)) / sizeof(uint64_t);
+
+    string file_name;
+    int fd = -1;
+    char *base = nullptr;
+    size_t mapped = 0;
+
+    Meta meta;                          // 当前事务中的状态，提交时写入超级块
+    int meta_slot = 0;                  // 最近一次提交所在的超级块（第0或第1页）
+    uint64_t txn = 0;                   // 当前事务号，等于最近一次提交的序号加一
+    bool modified = false;
+
+    vector<uint64_t> free_pages;        // 现在就可以复用的页
+    vector<uint64_t> pending_free;      // 本事务中被替换下来的已提交页，提交之后才能复用
+    vector<uint64_t> freelist_pages;    // 最近一次提交的空闲链表本身占用的页
+    bool free_loaded = false;           // 空闲链表在第一次修改时才读入，打开时不读
+
+    vector<uint64_t> dirty_pages;       // 本事务写过的页，提交时成批写回
+
+    AsyncIO *io = nullptr;
+    int prefetch_leaves = 0;            // 范围查询最多往后预读的兄弟叶子数
+    int async_lookups = 0;              // 在途的异步查找数，不为0时不允许修改
+    std::unordered_map<uint64_t, PageFetch> fetches;    // 正在读的页
+    long system_page = sysconf(_SC_PAGESIZE);
+
+    uint64_t commits = 0;
+    uint64_t cow_copies = 0;
+    uint64_t page_reads = 0;
+    uint64_t read_errors = 0;
+    uint64_t prefetched_pages = 0;
+
+    char *page(uint64_t id) const;
+    PageHeader *header(uint64_t id) const;
+    key_type *inner_keys(uint64_t id) const;
+    uint64_t *inner_children(uint64_t id) const;
+    LeafSlot *leaf_slots(uint64_t id) const;
+
+    static uint64_t checksum(const Meta &m);
+    bool read_meta(int slot, Meta &m) const;
+    bool grow(uint64_t pages);
+    bool reserve(uint64_t pages);
+    void load_free_list();
+    uint64_t alloc_page(bool leaf);
+    void free_page(uint64_t id);
+    uint64_t writable(uint64_t id);
+
+    static int leaf_find(const char *p, const key_type &key);
+    static int child_index(const char *p, const key_type &key);
+    static uint64_t child_at(const char *p, int index);
+    int leaf_space(uint64_t id) const;
+    void leaf_erase(uint64_t id, int pos);
+    void leaf_insert(uint64_t id, int pos, const key_type &key, const value_type &value);
+    void leaf_fill(uint64_t id, const vector<std::pair<key_type, value_type>> &entries, size_t first, size_t last);
+    void leaf_entries(uint64_t id, vector<std::pair<key_type, value_type>> &entries) const;
+    void inner_fill(uint64_t id, const vector<key_type> &keys, const vector<uint64_t> &children, size_t first, size_t last);
+    uint64_t put_rec(uint64_t id, const key_type &key, const value_type &value, bool &inserted,
+                     bool &split, key_type &sep, uint64_t &right);
+    uint64_t remove_rec(uint64_t id, const key_type &key);
+
+    bool resident(uint64_t id) const;
+    void lookup_from(std::shared_ptr<AsyncLookup> lookup, uint64_t id);
+    void lookup_page(std::shared_ptr<AsyncLookup> lookup, const char *p);
+    void fetch_done(uint64_t id, int res);
+    void finish_lookup(const std::shared_ptr<AsyncLookup> &lookup, const char *p, LookupStatus status = LOOKUP_ABSENT);
+    void prefetch_siblings(uint64_t parent, int index, int leaves, uint64_t &fetched_parent, int &fetched_to);
+    bool writeback();
+};
+
+#endif
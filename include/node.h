@@ -2,10 +2,28 @@
 #define __NODE_H__
 
 #include "utils.h"
+#include <cstdint>
 //#include "tree.h"
 
+// 写优化模式下缓冲在内部节点中、尚未作用到叶子的消息
+enum MessageType{
+    MSG_PUT,        // 插入或覆盖
+    MSG_UPDATE,     // 键存在时修改value
+    MSG_DELETE      // 删除
+};
+
+struct ColdLeaf;
+
+struct Message{
+    key_type key;
+    MessageType type;
+    value_type value;
+};
+
 class BPlusNode{
     friend class BPlusTree;
+    friend class LearnedIndex;
+    friend class TreeBuilder;
 
 private:
     bool leaf;
@@ -13,7 +31,12 @@ private:
     vector<key_type> keys;
     vector<value_type> values;
     vector<BPlusNode*> children;
+    vector<int> counts;     // 内部节点：各孩子子树中的键数，仅在启用顺序统计时维护
+    vector<vector<Message>> buffer;     // 内部节点：待下推的消息，按孩子分区，分区内按键有序且每个键至多一条；仅在写优化模式下使用
+    int buffered = 0;                   // 内部节点：缓冲中的消息总数
     BPlusNode * next_leaf = nullptr;
+    ColdLeaf *cold = nullptr;           // 叶子：非空时values已被压缩，读写value或增删键之前要先解压
+    uint32_t last_access = 0;           // 叶子：最近一次读写value时的分层周期
 
 public:
     BPlusNode();
@@ -0,0 +1,65 @@
+#ifndef __RESTRUCTURE_H__
+#define __RESTRUCTURE_H__
+
+#include "utils.h"
+#include "node.h"
+#include <cstdint>
+#include <ostream>
+
+/*
+ * 在线重建：按新的叶子度数与内部节点度数，把一棵正在使用的树流式地复制成一棵新树，复制完后一次换根
+ * TreeBuilder按键序逐条追加键值对：叶子装满（度数-1个键）就开下一个并串上叶子链表，同时沿最右一条路径往上补索引，
+ * 内存中只有最右路径上的节点是“开着的”；结束时自顶向下检查最右路径，不足半满的节点从左兄弟（一定是满的）匀过来一部分
+ * 复制分步进行，两步之间旧树照常服务读写：进度记为一个键游标，每一步从游标处重新下降，不依赖上一步留下的节点指针；
+ * 重建期间被修改过的键区间记在日志中，换根前以旧树为准逐个区间改正新树
+ * 换根只包括改正与替换根指针；旧树的节点在后台线程中释放
+ */
+
+class TreeBuilder{
+public:
+    TreeBuilder(int leaf_degree, int nonleaf_degree);
+    ~TreeBuilder();
+
+    BPlusNode *add(const key_type &key, const value_type &value);
+    BPlusNode *finish();
+    size_t leaves() const;
+    size_t keys() const;
+
+private:
+    int leaf_degree;
+    int nonleaf_degree;
+    vector<BPlusNode*> spine;       // 每一层最右的节点，spine[0]为最右的叶子，spine.back()为根
+    size_t leaf_count = 0;
+    size_t key_count = 0;
+
+    BPlusNode *new_node(bool leaf);
+    void push_up(size_t level, const key_type &sep, BPlusNode *left, BPlusNode *right);
+    void fix_right_edge();
+};
+
+struct RestructureStats{
+    int leaf_degree = 0;
+    int nonleaf_degree = 0;
+    bool active = false;            // 正在重建
+    bool copied = false;            // 已复制完，等待换根
+    uint64_t steps = 0;
+    uint64_t leaves_copied = 0;     // 复制过的旧叶子数
+    uint64_t keys_copied = 0;
+    uint64_t logged_ranges = 0;     // 重建期间记下的被修改区间数
+    uint64_t repaired_keys = 0;     // 换根前按旧树改正的键数
+
+    void print(std::ostream &os) const;
+};
+
+// 一次进行中的重建
+struct Restructure{
+    TreeBuilder builder;
+    key_type cursor = 0;            // 下一步从不小于cursor的键开始复制
+    bool started = false;
+    vector<std::pair<key_type, key_type>> touched;  // 重建期间被修改过的键区间
+    RestructureStats stats;
+
+    Restructure(int leaf_degree, int nonleaf_degree);
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <atomic>
+#include <ostream>
+
+/*
+ * 运行时统计：操作计数器与延迟直方图
+ * 编译时定义 BPT_ENABLE_STATS 才会在热路径上埋点，未定义时所有埋点宏展开为空，没有任何开销。
+ * 计数器按线程保存（thread_local），由快照接口汇总所有线程的数据。
+ */
+
+// 被统计延迟的操作类型
+enum StatOp{
+    OP_SEARCH,
+    OP_INSERT,
+    OP_MODIFY,
+    OP_DELETE,
+    OP_SCAN,
+    OP_DELETE_RANGE,
+    OP_UPSERT,
+    OP_UPDATE,
+    OP_BATCH,           // 一次applyBatch，单个操作由其各自的计时器另外记录
+    OP_COUNT
+};
+
+// 计数器类型
+enum StatCounter{
+    CNT_NODES_VISITED,      // 访问的节点数
+    CNT_KEYS_COMPARED,      // 比较的键数
+    CNT_SPLITS,             // 节点分裂次数
+    CNT_BORROWS,            // 向兄弟借键次数
+    CNT_MERGES,             // 节点合并次数
+    CNT_INDEX_CHANGES,      // change_index 向上改索引次数
+    CNT_FLUSHES,            // 写优化模式下缓冲向下推的批次
+    CNT_BATCHED_OPS,        // 成批修改中直接在叶子上作用、没有退回单个操作路径的操作数
+    CNT_COUNT
+};
+
+const char *statOpName(StatOp op);
+const char *statCounterName(StatCounter c);
+
+// 延迟直方图（HDR风格）：小于16ns的值精确记录，其余每个2的幂区间再均分为16个子桶，相对误差不超过1/16
+class LatencyHistogram{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketValue(int index);     // 桶内的最大值
+
+    void record(uint64_t value);
+    void addBucket(int index, uint64_t n, uint64_t sum);
+    void merge(const LatencyHistogram &other);
+    void subtract(const LatencyHistogram &other);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t bucketCount(int index) const;
+    double mean() const;
+    uint64_t max() const;
+    uint64_t percentile(double p) const;    // p 取值 [0, 100]
+
+private:
+    uint64_t counts[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+};
+
+// 统计快照
+struct StatsSnapshot{
+    uint64_t counters[CNT_COUNT] = {};
+    LatencyHistogram latency[OP_COUNT];
+
+    void print(std::ostream &os) const;
+};
+
+namespace stats{
+
+// 每个线程私有的统计数据：只有所属线程写入，用 relaxed 原子变量保证其他线程汇总时读到的值完整
+struct ThreadStats{
+    std::atomic<uint64_t> counters[CNT_COUNT];
+    std::atomic<uint64_t> buckets[OP_COUNT][LatencyHistogram::BUCKETS];
+    std::atomic<uint64_t> sum[OP_COUNT];
+
+    ThreadStats();
+    ~ThreadStats();
+};
+
+inline ThreadStats &local(){
+    thread_local ThreadStats ts;
+    return ts;
+}
+
+// 只有本线程写，用 load + store 代替带锁前缀的 fetch_add
+inline void bump(std::atomic<uint64_t> &c, uint64_t n){
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void add(StatCounter c, uint64_t n){
+    bump(local().counters[c], n);
+}
+
+inline void recordLatency(StatOp op, uint64_t ns){
+    ThreadStats &ts = local();
+    bump(ts.buckets[op][LatencyHistogram::bucketIndex(ns)], 1);
+    bump(ts.sum[op], ns);
+}
+
+// 作用域计时器：构造时开始计时，析构时记录到对应操作的直方图
+class ScopedTimer{
+public:
+    explicit ScopedTimer(StatOp op): op(op), start(std::chrono::steady_clock::now()){}
+    ~ScopedTimer(){
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        recordLatency(op, ns);
+    }
+private:
+    StatOp op;
+    std::chrono::steady_clock::time_point start;
+};
+
+StatsSnapshot snapshot();   // 汇总所有线程（含已退出线程）自上次 reset 以来的数据
+void reset();
+
+}
+
+#ifdef BPT_ENABLE_STATS
+#define BPT_STAT_ADD(counter, n)    stats::add(counter, n)
+#define BPT_STAT_TIMER(op)          stats::ScopedTimer bpt_stat_timer_(op)
+#else
+// 关闭时参数放在sizeof中不求值，只用于统计的局部变量也不会产生未使用的警告
+#define BPT_STAT_ADD(counter, n)    ((void)sizeof(counter), (void)sizeof(n))
+#define BPT_STAT_TIMER(op)          ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include "utils.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+ * 定长线程池：构造时启动固定数目的工作线程，任务放进一个共享队列，空闲的线程取出执行
+ * wait() 阻塞到已提交的任务全部执行完，同一个池可以反复提交、等待；析构时等待剩余任务后回收线程
+ */
+
+class ThreadPool{
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    int size() const;
+    void submit(std::function<void()> task);
+    void wait();
+
+private:
+    vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable task_ready;     // 有新任务或正在关闭
+    std::condition_variable all_done;       // 队列为空且没有正在执行的任务
+    int running = 0;                        // 正在执行的任务数
+    bool stopping = false;
+
+    void worker_loop();
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __TIERING_H__
+#define __TIERING_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <ostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <map>
+
+/*
+ * 冷热分层：每个叶子记下最近一次读写其value时的周期，连续若干周期没被访问的冷叶子把values压缩成一段字节
+ * 叶子节点、键与叶子链表都不动，下降、路由、兄弟之间比较键都不受影响，只有按键读写value或增删键时才需先解压；
+ * 范围查询与块扫描只解出一份副本，不解压回叶子，也不算作访问
+ * 压缩：每个value与前一个value比较，只记共同前缀长度、共同后缀长度和中间不同的部分（变长整数编码）；
+ * 相邻键的value结构通常相同，压缩率很高，即使完全不同也省掉了每个std::string本身的32字节
+ * 压缩字节可以留在内存中，也可以写入溢出文件，内存中只留文件中的位置
+ * 后台线程每隔一段时间沿叶子链表扫描一遍，每次持锁处理一批叶子；开启分层后树的公开操作都持有同一把可重入锁
+ */
+
+struct TieringConfig{
+    int cold_epochs = 2;        // 连续这么多个周期没被访问的叶子视为冷叶子
+    int interval_ms = 0;        // 后台线程两遍扫描之间的间隔，0表示不启动后台线程，只在调用tier_cold_leaves时扫描
+    int batch_leaves = 256;     // 后台线程每次持锁处理的叶子数，越小对前台操作的延迟影响越小
+    string spill_file;          // 非空时压缩字节写入此文件
+};
+
+// 溢出文件：冷叶子解压或释放后，它占的那段空间记为空闲，之后写入的压缩字节优先放进能装下的最小空闲段；
+// 相邻的空闲段合并，位于文件末尾的空闲段直接截掉。最后一个引用它的冷叶子释放时关闭并删除
+class SpillFile{
+public:
+    static std::shared_ptr<SpillFile> open(const string &path);
+    ~SpillFile();
+
+    bool write(const string &data, uint64_t &offset);
+    bool read(uint64_t offset, uint32_t length, string &data);
+    void release(uint64_t offset, uint32_t length);
+    uint64_t size() const;
+    uint64_t liveBytes() const;
+
+private:
+    SpillFile() = default;
+
+    string path;
+    int fd = -1;
+    std::atomic<uint64_t> end{0};
+    std::atomic<uint64_t> live{0};                  // 仍被冷叶子引用的字节数
+    std::mutex extent_mutex;                        // 保护以下两个空闲段索引
+    std::map<uint64_t, uint64_t> free_by_offset;    // 空闲段：起点 -> 长度
+    std::multimap<uint64_t, uint64_t> free_by_size; // 空闲段：长度 -> 起点
+
+    uint64_t allocate(uint64_t length);
+    void erase_extent(std::map<uint64_t, uint64_t>::iterator it);
+};
+
+// 一个冷叶子压缩后的values
+struct ColdLeaf{
+    string data;                        // 留在内存中时的压缩字节
+    std::shared_ptr<SpillFile> file;    // 非空时压缩字节在溢出文件中
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint32_t raw_bytes = 0;             // 压缩前所有value的字节数
+
+    ~ColdLeaf();                        // 在溢出文件中时归还占用的空间
+};
+
+void encode_values(const vector<value_type> &values, int n, string &out);
+bool decode_values(const string &data, int n, vector<value_type> &values);
+
+struct TierStats{
+    size_t leaves = 0;
+    size_t cold_leaves = 0;
+    size_t spilled_leaves = 0;
+    size_t inner_bytes = 0;         // 内部节点占用的内存
+    size_t hot_bytes = 0;           // 未压缩的叶子占用的内存（节点、键、value及其堆内存）
+    size_t cold_bytes = 0;          // 压缩的叶子留在内存中的部分（节点、键、压缩字节）
+    size_t cold_raw_bytes = 0;      // 压缩的叶子中value解压后的字节数
+    size_t spilled_bytes = 0;       // 溢出文件的大小
+    size_t spilled_live_bytes = 0;  // 溢出文件中仍被冷叶子引用的字节
+    uint64_t freezes = 0;           // 压缩叶子的次数
+    uint64_t thaws = 0;             // 访问时解压叶子的次数
+    uint64_t sweeps = 0;            // 完整扫描的遍数
+
+    size_t residentBytes() const;
+    void print(std::ostream &os) const;
+};
+
+class Tierer{
+    friend class BPlusTree;
+
+public:
+    // step每次处理一批叶子，扫完一遍时返回true；后台线程调用step时持有mutex()
+    Tierer(const TieringConfig &config, const std::function<bool()> &step);
+    ~Tierer();
+
+    void start();
+    std::recursive_mutex &mutex();
+    bool isCold(uint32_t last_access) const;
+
+private:
+    TieringConfig config;
+    std::shared_ptr<SpillFile> spill;
+    uint32_t epoch = 1;             // 当前周期，每扫完一遍加一
+    key_type hand = 0;              // 下一批从hand所在的叶子开始
+    bool hand_valid = false;        // false时从最左边的叶子开始
+
+    std::atomic<uint64_t> freezes{0};
+    std::atomic<uint64_t> thaws{0};
+    uint64_t sweeps = 0;
+
+    std::function<bool()> step;
+    std::recursive_mutex tree_mutex;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+
+    void run();
+};
+
+// 开启分层时持有树的锁，未开启时什么也不做
+class TierGuard{
+public:
+    explicit TierGuard(Tierer *tierer);
+    ~TierGuard();
+
+private:
+    Tierer *tierer;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "utils.h"
+#include <cstdint>
+#include <mutex>
+
+/*
+ * 操作轨迹的记录与读取
+ * 文件格式：8字节魔数 "BPTTRACE" + 1字节版本号，之后每条记录为：
+ *   1字节操作类型 | 距上一条记录的时间差(ns, varint) | 键(zigzag varint)
+ *   插入/修改/插入或更新/原地修改额外带 value 长度(varint) + value 字节；范围查询额外带读取数目(varint)；
+ *   范围删除额外带区间右端点(zigzag varint)
+ * 配合 save_to_file 的快照，可以在另一棵树上重放真实的访问序列
+ */
+
+enum TraceOp{
+    TRACE_SEARCH,
+    TRACE_INSERT,
+    TRACE_MODIFY,
+    TRACE_DELETE,
+    TRACE_SCAN,
+    TRACE_DELETE_RANGE,
+    TRACE_UPSERT,       // upsert 与 merge（merge记合并后的value）
+    TRACE_UPDATE,       // update：修改函数无法记录，记修改后的value，重放时作为修改
+    TRACE_OP_COUNT
+};
+
+const char *traceOpName(TraceOp op);
+
+struct TraceRecord{
+    TraceOp op;
+    uint64_t time_ns;   // 距轨迹开始的时间
+    key_type key;
+    value_type value;   // 插入/修改
+    uint64_t count;     // 范围查询的数目
+    key_type end_key;   // 范围删除的右端点
+};
+
+// 轨迹记录器：可被多个线程共享，内部加锁并缓冲写入
+class TraceRecorder{
+public:
+    TraceRecorder() = default;
+    ~TraceRecorder();
+
+    bool open(const string &file_name);
+    void close();
+    void record(TraceOp op, const key_type &key, const value_type *value = nullptr, uint64_t count = 0);
+    void recordRange(TraceOp op, const key_type &lo, const key_type &hi);
+
+private:
+    static const size_t FLUSH_SIZE = 1 << 16;
+
+    std::mutex mtx;
+    std::ofstream out;
+    string buffer;
+    std::chrono::steady_clock::time_point start;
+    uint64_t last_ns = 0;
+
+    void flush();
+    void put_header(TraceOp op, const key_type &key);
+};
+
+// 轨迹读取器
+class TraceReader{
+public:
+    bool open(const string &file_name);
+    bool next(TraceRecord &rec);
+
+private:
+    std::ifstream in;
+    uint64_t time_ns = 0;
+
+    bool read_varint(uint64_t &v);
+};
+
+#endif
@@ -3,6 +3,37 @@
 
 #include "utils.h"
 #include "node.h"
+#include "stats.h"
+#include "trace.h"
+#include "hot_cache.h"
+#include "learned_index.h"
+#include "block_scan.h"
+#include "thread_pool.h"
+#include "tiering.h"
+#include "async_io.h"
+#include "restructure.h"
+#include "flat_combine.h"
+#include <functional>
+#include <thread>
+
+// 合并算子：把operand合并进已有的value
+typedef std::function<void(value_type &existing, const value_type &operand)> MergeOperator;
+
+// 搜索路径：记录从根往下每一层经过的内部节点及走向的孩子位置
+// 深度固定、放在栈上，插入/删除的整个调整过程都不需要为路径分配堆内存
+struct TreePath{
+    static const int MAX_DEPTH = 64;
+
+    BPlusNode *nodes[MAX_DEPTH];
+    int slots[MAX_DEPTH];
+    int depth = 0;
+
+    void push(BPlusNode *node, int slot){ nodes[depth] = node; slots[depth] = slot; depth++; }
+    void pop(){ depth--; }
+    bool empty() const { return depth == 0; }
+    BPlusNode *node() const { return nodes[depth-1]; }    // 最深一层的节点
+    int slot() const { return slots[depth-1]; }           // 最深一层走向的孩子位置
+};
 
 class BPlusTree{
 private:
@@ -12,12 +43,28 @@ private:
     int nonleaf_min_degree = (nonleaf_max_degree+1)/2;
 
     BPlusNode *root = nullptr;
+    bool order_stats = false;   // 是否维护子树键数（顺序统计）
+    bool write_optimized = false;   // 写优化模式：修改先以消息缓冲在内部节点中，攒够一批再往下推
+    int buffer_capacity = 0;        // 每个内部节点缓冲的消息数上限
+    long buffered_messages = 0;     // 所有缓冲中尚未作用到叶子的消息数
+    vector<key_type> scratch_keys;      // 消息成批作用到叶子时复用的临时数组
+    vector<value_type> scratch_values;
 
     string data_file;
     std::ifstream from_file;
     std::ofstream to_file;
+    BPlusNode *last_leaf = nullptr;     // 反序列化时上一个读入的叶节点，用于串起叶子链表
 
-    void serializeNodeToFile(BPlusNode* node);
+    TraceRecorder *recorder = nullptr;  // 非空时记录公开操作的轨迹
+    HotCache *hot_cache = nullptr;      // 非空时查找先经过热点键缓存
+    LearnedIndex *learned_index = nullptr;  // 非空时查找/修改由学习模型预测叶子，跳过内部节点
+    Tierer *tierer = nullptr;           // 非空时开启冷热分层，长时间没被访问的叶子压缩存放
+    Restructure *restructure = nullptr; // 非空时正在把树重建成新的度数
+    RestructureStats last_restructure;  // 最近一次完成的重建
+    std::thread reclaimer;              // 换根后在后台释放旧树
+    MergeOperator merge_operator;
+
+    void serializeNodeToFile(BPlusNode* node, std::ostream &out);
     BPlusNode* deserializeNodeFromFile();
 
 public:
@@ -25,7 +72,9 @@ public:
     BPlusTree(int degree);
     ~BPlusTree();
     bool set_degree(int degree);
+    bool set_degrees(int leaf_degree, int nonleaf_degree);
     int getDegree();
+    int getNonleafDegree();
 
 
     /************** 封装 ***************/
@@ -35,27 +84,134 @@ public:
     bool searchKeyValue(const key_type &key, value_type &value);
     bool modifyKeyValue(const key_type &key, const value_type &value);
 
+    /************** 范围查询 ***************/
+    int scanKeyValue(const key_type &start_key, int count, vector<std::pair<key_type, value_type>> &result);
+
+    /************** 块扫描与并行聚合 ***************/
+    int scanBlocks(const key_type &lo, const key_type &hi, const std::function<bool(const LeafSpan &)> &visit);
+    int filterRange(const key_type &lo, const key_type &hi, const KeyPredicate &pred, vector<key_type> &result);
+    RangeAggregate aggregateRange(const key_type &lo, const key_type &hi, const KeyPredicate *pred = nullptr);
+    RangeAggregate parallelAggregate(const key_type &lo, const key_type &hi, ThreadPool &pool, const KeyPredicate *pred = nullptr);
+    BPlusNode *leaf_for(BPlusNode *node, const key_type &key);
+    int scan_leaves(BPlusNode *leaf, const key_type &lo, const key_type &hi, const std::function<bool(const LeafSpan &)> &visit);
+
     /************** 插入 ***************/
     int find_key_index(BPlusNode *node, const key_type &key);
     void insert_into_leaf(BPlusNode *leaf, const key_type &key, const value_type &value);
-    void insert_into_nonleaf(BPlusNode *node, const key_type &key, BPlusNode *child);
+    void insert_into_nonleaf(BPlusNode *node, int index, const key_type &key, BPlusNode *child);
+    void reserve_node(BPlusNode *node);
     key_type split_leaf(BPlusNode *leaf);
     key_type split_nonleaf(BPlusNode *node, BPlusNode *&new_nonleaf);
     bool insertKeyValue(const key_type &key, const value_type &value);
+    void split_upward(BPlusNode *leaf, TreePath &path);
+
+    /************** 插入或更新 ***************/
+    bool upsert(const key_type &key, const value_type &value);
+    bool update(const key_type &key, const std::function<void(value_type &)> &fn);
+    void set_merge_operator(const MergeOperator &op);
+    bool merge(const key_type &key, const value_type &operand);
+    bool upsert_leaf(const key_type &key, const value_type &value, const MergeOperator *merge_op, value_type *result = nullptr);
 
     /************** 删除 ***************/
     bool deleteKeyValue(const key_type &key);
-    void adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path);
-    void adjustNonLeafNode(vector<BPlusNode*> path);
-    int child_index(BPlusNode *parent, BPlusNode *node);
-    void change_index(BPlusNode *current_node, vector<BPlusNode*> path);
+    void adjustLeafNode(BPlusNode *node, TreePath &path);
+    void adjustNonLeafNode(TreePath &path);
+    void change_index(BPlusNode *current_node, const TreePath &path);
+
+    /************** 顺序统计 ***************/
+    bool enable_order_statistics(bool enable);
+    int subtree_count(BPlusNode *node);
+    void build_counts(BPlusNode *node);
+    int rank_of(const key_type &key, bool inclusive);
+    int rank(const key_type &key);
+    bool select(int k, key_type &key, value_type &value);
+    int countRange(const key_type &lo, const key_type &hi);
+
+    /************** 范围删除 ***************/
+    int deleteRange(const key_type &lo, const key_type &hi);
+    bool trim_range(BPlusNode *node, const key_type &lo, const key_type &hi, int &removed);
+    void repair_range(BPlusNode *node, const key_type &lo, const key_type &hi);
+    void repair_children(BPlusNode *node);
+    int rebalance_child(BPlusNode *parent, int index);
+    bool is_underflow(BPlusNode *node);
+    int free_subtree(BPlusNode *node);
+
+    /************** 分裂与拼接 ***************/
+    bool split_at(const key_type &key, BPlusTree &right);
+    bool join(BPlusTree &&other);
+    int subtree_height(BPlusNode *node);
+    BPlusNode *join_subtrees(BPlusNode *a, int ha, const key_type &sep, BPlusNode *b, int hb, int &height);
+
+    /************** 写优化（消息缓冲） ***************/
+    bool set_write_optimized(bool enable, int capacity = 0);
+    long pending_messages();
+    void flush_all();
+    void ensure_buffer(BPlusNode *node);
+    void put_message(Message &&msg);
+    void add_message(BPlusNode *node, int index, Message &&msg);
+    void merge_messages(BPlusNode *node, Message *first, Message *last);
+    int merge_partition(vector<Message> &part, Message *first, Message *last);
+    void apply_messages(BPlusNode *leaf, Message *first, Message *last);
+    void flush_node(BPlusNode *node);
+    void drain_node(BPlusNode *node);
+    void fix_children(BPlusNode *node, int lo, int hi);
+    int split_child(BPlusNode *parent, int index);
+    void split_partition(vector<Message> &from, vector<Message> &to, const key_type &split_key);
+    void fix_root();
+    bool buffered_search(const key_type &key, value_type &value);
 
     void build_tree_from(string file_name);
     void save_to_file();
+    bool save_to_file(AsyncIO &io);
     void clear_tree();
     bool is_bplustree();
     void verify();
 
+    /************** 统计 ***************/
+    static StatsSnapshot getStats();
+    static void resetStats();
+
+    /************** 轨迹记录 ***************/
+    void set_recorder(TraceRecorder *rec);
+
+    /************** 热点键缓存 ***************/
+    void enable_hot_cache(size_t entries);
+    HotCacheStats getHotCacheStats();
+    void resetHotCacheStats();
+
+    /************** 学习索引 ***************/
+    bool enable_learned_index(int epsilon);
+    void retrain_learned_index();
+    BPlusNode *learned_leaf(const key_type &key);
+    size_t inner_node_bytes(BPlusNode *node);
+    LearnedIndexStats getLearnedIndexStats();
+
+    /************** 在线重建 ***************/
+    bool begin_restructure(int leaf_degree, int nonleaf_degree);
+    bool restructure_step(int max_leaves);
+    bool finish_restructure();
+    void abort_restructure();
+    bool restructuring();
+    RestructureStats getRestructureStats();
+    void note_write(const key_type &lo, const key_type &hi);
+    void retire_subtree(BPlusNode *node);
+    void apply_degrees(int leaf_degree, int nonleaf_degree);
+
+    /************** 成批修改 ***************/
+    int applyBatch(CombinedOp **first, CombinedOp **last);
+    void apply_single(CombinedOp &op);
+
+    /************** 冷热分层 ***************/
+    bool enable_tiering(const TieringConfig &config);
+    void disable_tiering();
+    int tier_cold_leaves();
+    bool tier_step(int max_leaves, int &frozen);
+    void touch_leaf(BPlusNode *leaf);
+    void freeze_leaf(BPlusNode *leaf);
+    void thaw_leaf(BPlusNode *leaf);
+    bool read_cold_values(BPlusNode *leaf, vector<value_type> &values);
+    TierStats getTierStats();
+
 };
 
 void printBPT(BPlusNode* root);
@@ -0,0 +1,98 @@
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include "utils.h"
+#include <cstdint>
+
+/*
+ * 基准测试负载：可复现（固定种子）的键生成器与 YCSB 风格的混合负载
+ * 记录用编号 0..n-1 表示，编号 i 对应的键为 i+1
+ */
+
+// 键的分布
+enum KeyDistribution{
+    DIST_UNIFORM,       // 均匀分布
+    DIST_ZIPFIAN,       // Zipf分布（热点被打散到整个键空间）
+    DIST_SEQUENTIAL,    // 顺序循环
+    DIST_LATEST         // 偏向最近插入的记录
+};
+
+// 负载中的操作类型
+enum WorkloadOp{
+    WOP_READ,
+    WOP_UPDATE,
+    WOP_INSERT,
+    WOP_SCAN,
+    WOP_DELETE,
+    WOP_RMW,        // 读-改-写
+    WOP_COUNT
+};
+
+const char *workloadOpName(WorkloadOp op);
+const char *distributionName(KeyDistribution dist);
+
+// Zipf分布生成器（Gray等人的算法，与YCSB一致），返回 [0, items) 中的编号，编号越小越热
+class ZipfianGenerator{
+public:
+    ZipfianGenerator(uint64_t items, double theta = 0.99);
+    uint64_t next(std::mt19937_64 &rng);
+    void grow(uint64_t items);  // 记录数增加时增量更新 zeta
+
+private:
+    uint64_t items;
+    double theta;
+    double alpha;
+    double zeta2;
+    double zetan;
+    double eta;
+
+    void update_eta();
+};
+
+// 按分布从 [0, items) 中选出记录编号
+class KeyChooser{
+public:
+    KeyChooser(KeyDistribution dist, uint64_t items, uint64_t seed);
+    uint64_t next(uint64_t items);
+
+private:
+    KeyDistribution dist;
+    std::mt19937_64 rng;
+    ZipfianGenerator zipf;
+    uint64_t cursor = 0;
+};
+
+// 负载描述：各操作的比例、键分布、扫描长度上限
+struct WorkloadSpec{
+    string name;
+    double proportion[WOP_COUNT] = {};
+    KeyDistribution dist = DIST_ZIPFIAN;
+    int max_scan_length = 100;
+
+    // 按名字取内置负载：YCSB A-F，以及带删除的滑动窗口负载 churn
+    static bool byName(const string &name, WorkloadSpec &spec);
+};
+
+// 负载实例：生成加载阶段的键序列，以及运行阶段的操作和键
+class Workload{
+public:
+    Workload(const WorkloadSpec &spec, uint64_t record_count, uint64_t seed);
+
+    key_type loadKey(uint64_t i);   // 加载阶段第i个插入的键（打乱顺序）
+    WorkloadOp nextOp();
+    key_type nextReadKey();         // 已存在的键
+    key_type nextInsertKey();       // 新键
+    key_type nextDeleteKey();       // 最老的键；只剩一条记录时返回已不存在的键
+    int nextScanLength();
+    uint64_t liveCount();
+
+private:
+    WorkloadSpec spec;
+    std::mt19937_64 rng;
+    KeyChooser chooser;
+    vector<key_type> load_order;
+    uint64_t insert_count;      // 已插入的记录数（下一个插入的编号）
+    uint64_t delete_count = 0;  // 已删除的记录数（删除从最老的记录开始）
+};
+
+#endif
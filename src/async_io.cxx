@@ -0,0 +1,432 @@
+#include "async_io.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+void AsyncIOStats::print(std::ostream &os) const
+{
+    os << "Async I/O (" << (uring ? "io_uring" : "thread pool") << "): reads=" << reads << " writes=" << writes
+       << " syncs=" << syncs << " prefetches=" << prefetches << " batches=" << batches
+       << " completed=" << completed << " errors=" << errors
+       << " read=" << bytes_read << "B written=" << bytes_written << "B"
+       << " max_inflight=" << max_inflight << endl;
+}
+
+AsyncIO::AsyncIO(int depth, bool use_uring, int fallback_threads)
+{
+    queue_depth = std::max(1, depth);
+    pool_threads = std::max(1, fallback_threads);
+    if(!use_uring || !setup_uring(queue_depth))
+        pool.reset(new ThreadPool(pool_threads));
+    slots.resize(queue_depth);
+    for(int i = queue_depth - 1; i >= 0; i--)
+        free_slots.push_back(i);
+    counters.uring = ring_fd >= 0;
+}
+
+// 先等在途的请求全部完成，回调中引用的缓冲区不会在I/O进行时失效
+AsyncIO::~AsyncIO()
+{
+    drain();
+    teardown_uring();
+    pool.reset();
+}
+
+bool AsyncIO::usingUring() const
+{
+    return ring_fd >= 0;
+}
+
+int AsyncIO::depth() const
+{
+    return queue_depth;
+}
+
+/*******************    io_uring     *********************/
+// 建立提交队列与完成队列并映射到用户态；失败时返回false，由调用者退回线程池
+bool AsyncIO::setup_uring(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0)
+        return false;
+
+    sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single)
+        sq_ring_bytes = cq_ring_bytes = std::max(sq_ring_bytes, cq_ring_bytes);
+    sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring = single ? sq_ring : mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqe_bytes = p.sq_entries * sizeof(io_uring_sqe);
+    sqe_mem = mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    ring_fd = fd;
+    if(sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_mem == MAP_FAILED || !probe_ops()){
+        teardown_uring();
+        return false;
+    }
+
+    char *sq = (char *)sq_ring, *cq = (char *)cq_ring;
+    sq_head = (unsigned *)(sq + p.sq_off.head);
+    sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq_head = (unsigned *)(cq + p.cq_off.head);
+    cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = cq + p.cq_off.cqes;
+    sq_entries = p.sq_entries;
+    queue_depth = std::min<int>(queue_depth, sq_entries);   // 提交队列每次都会被内核取空，在途数不超过它即可
+    return true;
+}
+
+// 有io_uring不等于支持要用的操作：READ/WRITE/FADVISE要5.6，否则请求都以-EINVAL完成；
+// 逐个探测，缺任何一个（或内核连探测都不支持）就退回线程池
+bool AsyncIO::probe_ops()
+{
+    const int ops = 256;
+    vector<char> buf(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = (io_uring_probe *)buf.data();
+    if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, ops) < 0)
+        return false;
+    for(int op : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SYNC_FILE_RANGE, IORING_OP_FADVISE})
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    return true;
+}
+
+// io_uring_enter出了不能重试的错误：在途的请求都以这个错误完成，关掉io_uring，之后的请求交给线程池
+void AsyncIO::abandon_uring(int err)
+{
+    std::cerr << "Error: io_uring_enter failed: " << strerror(-err) << ", falling back to thread pool" << endl;
+    reap_uring();
+    vector<char> idle(slots.size(), 0);
+    for(int slot : free_slots)
+        idle[slot] = 1;
+    for(auto &f : finished)
+        idle[f.first] = 1;
+    for(size_t slot = 0; slot < slots.size(); slot++)
+        if(!idle[slot])
+            finished.emplace_back(slot, err);
+    teardown_uring();
+    pool.reset(new ThreadPool(pool_threads));
+    counters.uring = false;
+}
+
+void AsyncIO::teardown_uring()
+{
+    if(ring_fd < 0)
+        return;
+    if(sqe_mem && sqe_mem != MAP_FAILED)
+        munmap(sqe_mem, sqe_bytes);
+    if(cq_ring && cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_bytes);
+    if(sq_ring && sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_bytes);
+    close(ring_fd);
+    ring_fd = -1;
+    sq_ring = cq_ring = sqe_mem = nullptr;
+}
+
+// 把排队的请求填进提交队列，与等待min_complete个完成合并成一次io_uring_enter
+int AsyncIO::submit_uring(int min_complete)
+{
+    unsigned tail = *sq_tail, to_submit = 0;
+    while(!queued.empty() && inflight < (size_t)queue_depth){
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = std::move(queued.front());
+        queued.pop();
+        inflight++;
+        const Request &r = slots[slot];
+
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe *sqe = (io_uring_sqe *)sqe_mem + index;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = r.fd;
+        sqe->off = r.offset;
+        sqe->len = r.length;
+        sqe->user_data = slot;
+        switch(r.op){
+        case OP_READ:
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)r.buf;
+            break;
+        case OP_WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)r.buf;
+            break;
+        case OP_SYNC:
+            sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+            sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+            break;
+        case OP_PREFETCH:
+            sqe->opcode = IORING_OP_FADVISE;
+            sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+            break;
+        }
+        sq_array[index] = index;
+        tail++;
+        to_submit++;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    // 上一次被信号打断等原因没被内核取走的也一起交出
+    unsigned pending = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(pending == 0 && min_complete == 0)
+        return 0;
+    if(to_submit)
+        counters.batches++;
+    counters.max_inflight = std::max(counters.max_inflight, inflight);
+
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while(syscall(__NR_io_uring_enter, ring_fd, pending, min_complete, flags, nullptr, 0) < 0){
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            abandon_uring(-errno);
+            break;
+        }
+        reap_uring();
+        pending = tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if(pending == 0 && (int)finished.size() >= min_complete)
+            break;
+    }
+    return to_submit;
+}
+
+// 把完成队列中的完成项搬到finished
+void AsyncIO::reap_uring()
+{
+    if(ring_fd < 0)
+        return;
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++){
+        io_uring_cqe *cqe = (io_uring_cqe *)cqes + (head & *cq_mask);
+        finished.emplace_back((int)cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*******************    线程池后端     *********************/
+void AsyncIO::run_on_pool(int slot)
+{
+    pool->submit([this, slot]{
+        const Request &r = slots[slot];
+        long ret = 0;
+        switch(r.op){
+        case OP_READ:
+            ret = pread(r.fd, r.buf, r.length, r.offset);
+            break;
+        case OP_WRITE:
+            ret = pwrite(r.fd, r.buf, r.length, r.offset);
+            break;
+        case OP_SYNC:
+            ret = sync_file_range(r.fd, r.offset, r.length,
+                                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            break;
+        case OP_PREFETCH:
+            ret = -posix_fadvise(r.fd, r.offset, r.length, POSIX_FADV_WILLNEED);
+            break;
+        }
+        if(ret < 0 && r.op != OP_PREFETCH)
+            ret = -errno;
+        {
+            std::lock_guard<std::mutex> lock(done_mtx);
+            done_list.emplace_back(slot, (int)ret);
+        }
+        done_cv.notify_one();
+    });
+}
+
+/*******************    排队、提交与收割     *********************/
+void AsyncIO::enqueue(Request &&req)
+{
+    queued.push(std::move(req));
+}
+
+void AsyncIO::read(int fd, void *buf, uint32_t length, uint64_t offset, Completion done)
+{
+    counters.reads++;
+    enqueue(Request{OP_READ, fd, buf, length, offset, std::move(done)});
+}
+
+void AsyncIO::write(int fd, const void *buf, uint32_t length, uint64_t offset, Completion done)
+{
+    counters.writes++;
+    enqueue(Request{OP_WRITE, fd, const_cast<void *>(buf), length, offset, std::move(done)});
+}
+
+// 把文件中[offset, offset+length)的脏页写回并等待写完（不含设备缓存的刷新，持久化还需fdatasync）
+void AsyncIO::syncRange(int fd, uint64_t offset, uint32_t length, Completion done)
+{
+    counters.syncs++;
+    enqueue(Request{OP_SYNC, fd, nullptr, length, offset, std::move(done)});
+}
+
+// 提示内核把这段文件读进页缓存，不关心结果
+void AsyncIO::prefetch(int fd, uint64_t offset, uint32_t length)
+{
+    counters.prefetches++;
+    enqueue(Request{OP_PREFETCH, fd, nullptr, length, offset, nullptr});
+}
+
+// 交出排队的请求（不超过队列深度），返回交出的个数
+int AsyncIO::submit()
+{
+    if(ring_fd >= 0)
+        return submit_uring(0);
+    int n = 0;
+    while(!queued.empty() && inflight < (size_t)queue_depth){
+        int slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = std::move(queued.front());
+        queued.pop();
+        inflight++;
+        run_on_pool(slot);
+        n++;
+    }
+    if(n)
+        counters.batches++;
+    counters.max_inflight = std::max(counters.max_inflight, inflight);
+    return n;
+}
+
+// 收割完成的请求并执行回调，至少等到min_complete个（不超过在途数）；返回执行的回调数
+int AsyncIO::poll(int min_complete)
+{
+    submit();
+    min_complete = std::min<int>(min_complete, inflight);
+    if(ring_fd >= 0){
+        reap_uring();
+        while(ring_fd >= 0 && (int)finished.size() < min_complete){
+            submit_uring(min_complete - finished.size());
+            reap_uring();
+        }
+    }
+    else{
+        // 刚退回线程池时，io_uring上在途的请求已经带着错误进了finished
+        std::unique_lock<std::mutex> lock(done_mtx);
+        done_cv.wait(lock, [&]{ return (int)(finished.size() + done_list.size()) >= min_complete; });
+        finished.insert(finished.end(), done_list.begin(), done_list.end());
+        done_list.clear();
+    }
+
+    // 先归还槽并交出排队的请求，再执行回调；回调中发起的请求留到下一次提交
+    vector<std::pair<Completion, int>> callbacks;
+    callbacks.reserve(finished.size());
+    for(auto &f : finished){
+        Request &r = slots[f.first];
+        int res = f.second;
+        counters.completed++;
+        if(res < 0)
+            counters.errors++;
+        else if(r.op == OP_READ)
+            counters.bytes_read += res;
+        else if(r.op == OP_WRITE)
+            counters.bytes_written += res;
+        callbacks.emplace_back(std::move(r.done), res);
+        r.done = nullptr;
+        free_slots.push_back(f.first);
+        inflight--;
+    }
+    finished.clear();
+    submit();
+    for(auto &c : callbacks)
+        if(c.first)
+            c.first(c.second);
+    return callbacks.size();
+}
+
+// 等到排队与在途的请求全部完成，包括回调中新发起的
+void AsyncIO::drain()
+{
+    while(inflight > 0 || !queued.empty())
+        poll(1);
+}
+
+size_t AsyncIO::outstanding() const
+{
+    return inflight + queued.size();
+}
+
+AsyncIOStats AsyncIO::getStats() const
+{
+    return counters;
+}
+
+void AsyncIO::resetStats()
+{
+    bool uring = counters.uring;
+    counters = AsyncIOStats();
+    counters.uring = uring;
+}
+
+/*******************    异步写文件的流缓冲     *********************/
+AsyncFileWriter::AsyncFileWriter(AsyncIO &io, int fd, size_t chunk_bytes, int chunks)
+    : io(io), fd(fd), buffers(std::max(2, chunks), vector<char>(chunk_bytes)), busy(buffers.size(), 0)
+{
+    setp(buffers[0].data(), buffers[0].data() + chunk_bytes);
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    finish();
+}
+
+AsyncFileWriter::int_type AsyncFileWriter::overflow(int_type ch)
+{
+    flush_current();
+    if(!traits_type::eq_int_type(ch, traits_type::eof())){
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+// 把当前块交给异步写，换到一块空闲的块继续；所有块都在写时等其中一块写完
+void AsyncFileWriter::flush_current()
+{
+    size_t n = pptr() - pbase();
+    if(n > 0){
+        int index = current;
+        busy[index] = 1;
+        io.write(fd, pbase(), n, offset, [this, index, n](int res){
+            busy[index] = 0;
+            if(res != (int)n)
+                failed = true;
+        });
+        offset += n;
+        io.submit();
+    }
+    while(true){
+        for(size_t i = 0; i < buffers.size(); i++){
+            int next = (current + 1 + i) % buffers.size();
+            if(!busy[next]){
+                current = next;
+                setp(buffers[next].data(), buffers[next].data() + buffers[next].size());
+                return;
+            }
+        }
+        io.poll(1);
+    }
+}
+
+// 写出剩余的数据并等待所有块写完；返回是否全部写成功
+bool AsyncFileWriter::finish()
+{
+    if(finished)
+        return !failed;
+    flush_current();
+    while(std::find(busy.begin(), busy.end(), 1) != busy.end())
+        io.poll(1);
+    finished = true;
+    return !failed;
+}
+
+uint64_t AsyncFileWriter::bytesWritten() const
+{
+    return offset;
+}
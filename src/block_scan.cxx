@@ -0,0 +1,293 @@
+#include "block_scan.h"
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BPT_AVX2_KERNELS
+#include <immintrin.h>
+static_assert(sizeof(key_type) == 4, "AVX2 kernels assume 32-bit keys");
+#endif
+
+// 所有谓词都化成 lo<=key<=hi 且 (key&mask)==pattern，再按negate取反，内核只需实现这一种形式
+struct NormalizedPredicate{
+    key_type lo;
+    key_type hi;
+    key_type mask;
+    key_type pattern;
+    bool negate;
+};
+
+static NormalizedPredicate normalize(const KeyPredicate &p)
+{
+    const key_type MIN = std::numeric_limits<key_type>::min();
+    const key_type MAX = std::numeric_limits<key_type>::max();
+    NormalizedPredicate n = {MIN, MAX, 0, 0, false};
+    switch(p.op){
+    case FILTER_EQ:      n.lo = n.hi = p.a; break;
+    case FILTER_NE:      n.lo = n.hi = p.a; n.negate = true; break;
+    case FILTER_LE:      n.hi = p.a; break;
+    case FILTER_GE:      n.lo = p.a; break;
+    case FILTER_BETWEEN: n.lo = p.a; n.hi = p.b; break;
+    case FILTER_MASK:    n.mask = p.a; n.pattern = p.b; break;
+    // 严格比较化成闭区间，边界取到类型极值时区间为空
+    case FILTER_LT:
+        if(p.a == MIN){ n.lo = MAX; n.hi = MIN; }
+        else n.hi = p.a - 1;
+        break;
+    case FILTER_GT:
+        if(p.a == MAX){ n.lo = MAX; n.hi = MIN; }
+        else n.lo = p.a + 1;
+        break;
+    }
+    return n;
+}
+
+static inline bool match(const NormalizedPredicate &p, key_type k)
+{
+    bool in = (k >= p.lo) & (k <= p.hi) & ((k & p.mask) == p.pattern);
+    return in != p.negate;
+}
+
+bool KeyPredicate::test(const key_type &key) const
+{
+    return match(normalize(*this), key);
+}
+
+void RangeAggregate::merge(const RangeAggregate &other)
+{
+    if(other.count == 0)
+        return;
+    if(count == 0){
+        min = other.min;
+        max = other.max;
+    }
+    else{
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+    count += other.count;
+    sum += other.sum;
+}
+
+void RangeAggregate::print(std::ostream &os) const
+{
+    os << "Aggregate: count=" << count << " sum=" << sum;
+    if(count)
+        os << " min=" << min << " max=" << max;
+    os << endl;
+}
+
+/*******************    标量内核     *********************/
+// 无分支：每个位置都写下标，只有满足谓词时才前移写指针
+static int filter_scalar(const key_type *keys, int n, const NormalizedPredicate &p, int *selection)
+{
+    int k = 0;
+    for(int i = 0; i < n; i++){
+        selection[k] = i;
+        k += match(p, keys[i]);
+    }
+    return k;
+}
+
+static int64_t sum_scalar(const key_type *keys, int n)
+{
+    int64_t sum = 0;
+    for(int i = 0; i < n; i++)
+        sum += keys[i];
+    return sum;
+}
+
+static void aggregate_scalar(const key_type *keys, int n, const NormalizedPredicate &p, RangeAggregate &agg)
+{
+    RangeAggregate part;
+    part.min = std::numeric_limits<key_type>::max();
+    part.max = std::numeric_limits<key_type>::min();
+    for(int i = 0; i < n; i++){
+        if(!match(p, keys[i]))
+            continue;
+        part.count++;
+        part.sum += keys[i];
+        part.min = std::min(part.min, keys[i]);
+        part.max = std::max(part.max, keys[i]);
+    }
+    agg.merge(part);
+}
+
+/*******************    AVX2内核     *********************/
+#ifdef BPT_AVX2_KERNELS
+// 8位掩码 -> 把置位的通道依次排到前面的重排下标；局部静态对象的初始化是线程安全的
+struct CompactTable{
+    alignas(32) int perm[256][8];
+
+    CompactTable(){
+        for(int m = 0; m < 256; m++){
+            int k = 0;
+            for(int i = 0; i < 8; i++)
+                if(m >> i & 1)
+                    perm[m][k++] = i;
+            for(; k < 8; k++)
+                perm[m][k] = 0;
+        }
+    }
+};
+
+static const CompactTable &compact_table()
+{
+    static const CompactTable table;
+    return table;
+}
+
+// 8个键满足谓词的通道为全1
+__attribute__((target("avx2")))
+static inline __m256i match8(__m256i v, __m256i lo, __m256i hi, __m256i mask, __m256i pattern, __m256i flip)
+{
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, v), _mm256_cmpgt_epi32(v, hi));
+    __m256i bits = _mm256_cmpeq_epi32(_mm256_and_si256(v, mask), pattern);
+    return _mm256_xor_si256(_mm256_andnot_si256(out, bits), flip);
+}
+
+// 每次写出8个下标再按实际个数前移，写出的位置不超过已处理的键数，selection只需n个元素
+__attribute__((target("avx2")))
+static int filter_avx2(const key_type *keys, int n, const NormalizedPredicate &p, int *selection)
+{
+    const CompactTable &table = compact_table();
+    const __m256i lo = _mm256_set1_epi32(p.lo), hi = _mm256_set1_epi32(p.hi);
+    const __m256i mask = _mm256_set1_epi32(p.mask), pattern = _mm256_set1_epi32(p.pattern);
+    const __m256i flip = _mm256_set1_epi32(p.negate ? -1 : 0);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int k = 0, i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        int m = _mm256_movemask_ps(_mm256_castsi256_ps(match8(v, lo, hi, mask, pattern, flip)));
+        __m256i perm = _mm256_load_si256((const __m256i *)table.perm[m]);
+        _mm256_storeu_si256((__m256i *)(selection + k), _mm256_permutevar8x32_epi32(idx, perm));
+        k += __builtin_popcount(m);
+        idx = _mm256_add_epi32(idx, step);
+    }
+    for(; i < n; i++){
+        selection[k] = i;
+        k += match(p, keys[i]);
+    }
+    return k;
+}
+
+// 32位键扩展成64位再累加，两个累加器分别处理低、高4个通道
+__attribute__((target("avx2")))
+static int64_t sum_avx2(const key_type *keys, int n)
+{
+    __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+    int i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        s0 = _mm256_add_epi64(s0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        s1 = _mm256_add_epi64(s1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256((__m256i *)lanes, _mm256_add_epi64(s0, s1));
+    int64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for(; i < n; i++)
+        sum += keys[i];
+    return sum;
+}
+
+// 不满足谓词的通道：求和时置0，求最小/最大时换成类型极值，计数时不减
+__attribute__((target("avx2")))
+static void aggregate_avx2(const key_type *keys, int n, const NormalizedPredicate &p, RangeAggregate &agg)
+{
+    const __m256i lo = _mm256_set1_epi32(p.lo), hi = _mm256_set1_epi32(p.hi);
+    const __m256i mask = _mm256_set1_epi32(p.mask), pattern = _mm256_set1_epi32(p.pattern);
+    const __m256i flip = _mm256_set1_epi32(p.negate ? -1 : 0);
+    const __m256i vmax_init = _mm256_set1_epi32(std::numeric_limits<key_type>::max());
+    const __m256i vmin_init = _mm256_set1_epi32(std::numeric_limits<key_type>::min());
+    __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256(), cnt = _mm256_setzero_si256();
+    __m256i vmin = vmax_init, vmax = vmin_init;
+
+    int i = 0;
+    for(; i + 8 <= n; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        __m256i in = match8(v, lo, hi, mask, pattern, flip);
+        __m256i sel = _mm256_and_si256(v, in);
+        s0 = _mm256_add_epi64(s0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(sel)));
+        s1 = _mm256_add_epi64(s1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(sel, 1)));
+        cnt = _mm256_sub_epi32(cnt, in);
+        vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(vmax_init, v, in));
+        vmax = _mm256_max_epi32(vmax, _mm256_blendv_epi8(vmin_init, v, in));
+    }
+
+    alignas(32) int64_t sums[4];
+    alignas(32) int counts[8], mins[8], maxs[8];
+    _mm256_store_si256((__m256i *)sums, _mm256_add_epi64(s0, s1));
+    _mm256_store_si256((__m256i *)counts, cnt);
+    _mm256_store_si256((__m256i *)mins, vmin);
+    _mm256_store_si256((__m256i *)maxs, vmax);
+
+    RangeAggregate part;
+    part.sum = sums[0] + sums[1] + sums[2] + sums[3];
+    part.min = std::numeric_limits<key_type>::max();
+    part.max = std::numeric_limits<key_type>::min();
+    for(int l = 0; l < 8; l++){
+        part.count += counts[l];
+        part.min = std::min(part.min, mins[l]);
+        part.max = std::max(part.max, maxs[l]);
+    }
+    agg.merge(part);
+    aggregate_scalar(keys + i, n - i, p, agg);
+}
+#endif
+
+/*******************    分派     *********************/
+// 只在运行时检测一次CPU是否支持AVX2
+bool simd_kernels_enabled()
+{
+#ifdef BPT_AVX2_KERNELS
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+// 把keys[0..n)中满足谓词的位置依次写入selection（至少n个元素），返回个数
+int filter_keys(const key_type *keys, int n, const KeyPredicate &pred, int *selection)
+{
+    NormalizedPredicate p = normalize(pred);
+#ifdef BPT_AVX2_KERNELS
+    if(simd_kernels_enabled())
+        return filter_avx2(keys, n, p, selection);
+#endif
+    return filter_scalar(keys, n, p, selection);
+}
+
+int64_t sum_keys(const key_type *keys, int n)
+{
+#ifdef BPT_AVX2_KERNELS
+    if(simd_kernels_enabled())
+        return sum_avx2(keys, n);
+#endif
+    return sum_scalar(keys, n);
+}
+
+// 把keys[0..n)中满足谓词的键并入agg；pred为空时不过滤，此时要求键升序，最小/最大值直接取两端
+void aggregate_keys(const key_type *keys, int n, const KeyPredicate *pred, RangeAggregate &agg)
+{
+    if(n <= 0)
+        return;
+    if(pred == nullptr){
+        RangeAggregate part;
+        part.count = n;
+        part.sum = sum_keys(keys, n);
+        part.min = keys[0];
+        part.max = keys[n-1];
+        agg.merge(part);
+        return;
+    }
+    NormalizedPredicate p = normalize(*pred);
+#ifdef BPT_AVX2_KERNELS
+    if(simd_kernels_enabled()){
+        aggregate_avx2(keys, n, p, agg);
+        return;
+    }
+#endif
+    aggregate_scalar(keys, n, p, agg);
+}
@@ -1,5 +1,12 @@
 #include "bpt_test.h"
+#include <limits>
+#include <map>
 
+// 按键的顺序读出树中所有的键值对
+static void scan_all(BPlusTree &bpt, vector<std::pair<key_type, value_type>> &result)
+{
+    bpt.scanKeyValue(std::numeric_limits<key_type>::min(), std::numeric_limits<int>::max(), result);
+}
 
 // 测试：插入
 int test_insertion(BPlusTree &bpt, int numInsertions, bool is_random)
@@ -77,6 +84,78 @@ double test_deletion(BPlusTree &bpt, int num)
 }
 
 
+// 测试：范围删除，删掉的个数应等于删除前[lo, hi]内的键数，删除后区间内不再有键
+int test_range_deletion(BPlusTree &bpt, int lo, int hi)
+{
+    cout << "Test running: Range deletion of [" << lo << ", " << hi << "]: ";
+    uint64_t expected = bpt.aggregateRange(lo, hi).count;
+
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    int removed = bpt.deleteRange(lo, hi);
+
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    auto durationInsert = std::chrono::duration_cast<std::chrono::microseconds>(endInsert - startInsert).count();
+    bool ok = (uint64_t)removed == expected && bpt.aggregateRange(lo, hi).count == 0 && bpt.is_bplustree();
+    std::cout << removed << " records removed in: " << durationInsert << " us"
+              << (ok ? "" : " (mismatch!)") << std::endl;
+    return durationInsert;
+}
+
+
+// 测试：从key处把树分裂成两棵，再拼接回来
+// 分裂后左树的键都小于key、右树的键都不小于key，两棵都是B+树；拼回后的键值序列与分裂前相同
+int test_split_join(BPlusTree &bpt, int key)
+{
+    cout << "Test running: Split at " << key << " and join back: ";
+    vector<std::pair<key_type, value_type>> before, left, right_entries, after;
+    scan_all(bpt, before);
+
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    BPlusTree right;
+    bool ok = bpt.split_at(key, right);
+    auto midInsert = std::chrono::high_resolution_clock::now();
+    scan_all(bpt, left);
+    scan_all(right, right_entries);
+    ok = ok && bpt.is_bplustree() && right.is_bplustree() && left.size() + right_entries.size() == before.size()
+         && (left.empty() || BPlusNode::cmpKeys(left.back().first, key) < 0)
+         && (right_entries.empty() || BPlusNode::cmpKeys(right_entries.front().first, key) >= 0);
+
+    auto joinStart = std::chrono::high_resolution_clock::now();
+    ok = bpt.join(std::move(right)) && ok;
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    scan_all(bpt, after);
+    ok = ok && bpt.is_bplustree() && after == before;
+
+    auto durationInsert = std::chrono::duration_cast<std::chrono::microseconds>((midInsert - startInsert) + (endInsert - joinStart)).count();
+    std::cout << left.size() << " + " << right_entries.size() << " records, time consumming: " << durationInsert << " us"
+              << (ok ? "" : " (mismatch!)") << std::endl;
+    return durationInsert;
+}
+
+
+// 测试：全范围聚合，单线程与线程池并行各一次
+int test_range_aggregate(BPlusTree &bpt, int threads)
+{
+    cout << "Test running: Range aggregate with " << threads << " thread(s): ";
+    const key_type lo = std::numeric_limits<key_type>::min(), hi = std::numeric_limits<key_type>::max();
+    ThreadPool pool(threads);
+
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    RangeAggregate serial = bpt.aggregateRange(lo, hi);
+    auto midInsert = std::chrono::high_resolution_clock::now();
+    RangeAggregate parallel = bpt.parallelAggregate(lo, hi, pool);
+
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    auto durationSerial = std::chrono::duration_cast<std::chrono::microseconds>(midInsert - startInsert).count();
+    auto durationInsert = std::chrono::duration_cast<std::chrono::microseconds>(endInsert - midInsert).count();
+    std::cout << serial.count << " keys, serial " << durationSerial << " us, parallel " << durationInsert << " us"
+              << (parallel.sum == serial.sum ? "" : " (mismatch!)") << std::endl;
+    return durationInsert;
+}
+
 // 测试：序列化
 int test_serialization(BPlusTree &bpt)
 {
@@ -105,6 +184,127 @@ int test_deserialization(BPlusTree &bpt, string file_name)
     return durationInsert;
 }
 
+// 测试：在线重建成新的度数，每步复制step_leaves个叶子，报告总耗时、单步与换根（即读写被挡住的）最长耗时；旧树在后台释放，不计入换根
+// 每两步之间插入或覆盖一个键、删除一个键，换根后树的内容应等于重建前的内容加上这些修改，度数应为新的度数
+int test_restructure(BPlusTree &bpt, int leaf_degree, int nonleaf_degree, int step_leaves)
+{
+    cout << "Test running: Online restructure to " << leaf_degree << "/" << nonleaf_degree << ": ";
+    vector<std::pair<key_type, value_type>> entries, after;
+    scan_all(bpt, entries);
+    std::map<key_type, value_type> expected(entries.begin(), entries.end());
+    key_type lo = entries.empty() ? 1 : entries.front().first, hi = entries.empty() ? 1 : entries.back().first;
+    std::mt19937 rng(leaf_degree);
+    std::uniform_int_distribution<key_type> pick(lo, hi);
+    int writes = 0;
+
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    long long max_step = 0;
+    bool ok = bpt.begin_restructure(leaf_degree, nonleaf_degree);
+    while(ok){
+        auto stepStart = std::chrono::high_resolution_clock::now();
+        bool done = bpt.restructure_step(step_leaves);
+        auto stepEnd = std::chrono::high_resolution_clock::now();
+        max_step = std::max<long long>(max_step, std::chrono::duration_cast<std::chrono::microseconds>(stepEnd - stepStart).count());
+        if(done)
+            break;
+
+        key_type key = pick(rng);
+        bpt.upsert(key, "R" + std::to_string(key));
+        expected[key] = "R" + std::to_string(key);
+        auto victim = expected.lower_bound(pick(rng));
+        if(victim != expected.end()){
+            bpt.deleteKeyValue(victim->first);
+            expected.erase(victim);
+        }
+        writes++;
+    }
+    auto swapStart = std::chrono::high_resolution_clock::now();
+    if(ok && bpt.restructuring())
+        ok = bpt.finish_restructure();
+
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    auto swapTime = std::chrono::duration_cast<std::chrono::microseconds>(endInsert - swapStart).count();
+    auto durationInsert = std::chrono::duration_cast<std::chrono::milliseconds>(endInsert - startInsert).count();
+    scan_all(bpt, after);
+    bool match = ok && bpt.getDegree() == leaf_degree && bpt.getNonleafDegree() == nonleaf_degree && bpt.is_bplustree()
+                 && after == vector<std::pair<key_type, value_type>>(expected.begin(), expected.end());
+    std::cout << "Time consumming: " << durationInsert << " ms, longest step " << max_step << " us, swap "
+              << swapTime << " us, " << writes << " writes between steps, degrees now " << bpt.getDegree() << "/"
+              << bpt.getNonleafDegree() << (ok ? (match ? "" : " (mismatch!)") : " (failed)") << std::endl;
+    return durationInsert;
+}
+
+// 测试：映射文件的冷启动，把树导入新建的file_name并提交，再计时重新打开到第一次查找返回
+// 导入的键数应等于树中的键数；重新打开后键数不变，均匀抽取的一些键的value与树中相同
+int test_mapped_startup(BPlusTree &bpt, string file_name, const key_type &key)
+{
+    cout << "Test running: Mapped tree startup: ";
+    vector<std::pair<key_type, value_type>> entries;
+    scan_all(bpt, entries);
+    unlink(file_name.c_str());
+    {
+        MappedTree mt;
+        int imported = mt.open(file_name) ? mt.importFrom(bpt) : -1;
+        if(imported != (int)entries.size() || !mt.commit()){
+            std::cout << "import failed: " << imported << " of " << entries.size() << " keys" << std::endl;
+            return -1;
+        }
+    }
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    MappedTree mt;
+    value_type value;
+    bool found = mt.open(file_name) && mt.search(key, value);
+
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    auto durationInsert = std::chrono::duration_cast<std::chrono::microseconds>(endInsert - startInsert).count();
+    bool ok = mt.getStats().keys == entries.size();
+    size_t step = std::max<size_t>(entries.size() / 100, 1);
+    for(size_t i = 0; ok && i < entries.size(); i += step)
+        ok = mt.search(entries[i].first, value) && value == entries[i].second;
+    std::cout << mt.getStats().keys << " keys, open + first search " << durationInsert << " us"
+              << (found ? "" : " (key not found)") << (ok ? "" : " (mismatch!)") << std::endl;
+    return durationInsert;
+}
+
+// 测试：逐个同步查找与用异步I/O成批查找各num个随机键的耗时
+// 两组键不同，前一组不会替后一组把页读进页缓存；页缓存开始时是冷是热由调用者决定
+// 计时之后再对成批查找的那组键逐个同步查找，两者的结果应完全一致
+int test_async_search(MappedTree &mt, AsyncIO &io, int num, int max_key)
+{
+    cout << "Test running: Mapped tree batch search (" << (io.usingUring() ? "io_uring" : "thread pool") << "): ";
+    std::mt19937 rng(num);
+    vector<key_type> sync_keys(num), keys(num);
+    for(auto &key : sync_keys)
+        key = rng() % max_key + 1;
+    for(auto &key : keys)
+        key = rng() % max_key + 1;
+    auto startInsert = std::chrono::high_resolution_clock::now();
+
+    value_type value;
+    int found = 0;
+    for(auto &key : sync_keys)
+        found += mt.search(key, value);
+    auto midInsert = std::chrono::high_resolution_clock::now();
+    vector<std::pair<LookupStatus, value_type>> results;
+    mt.set_async_io(&io);
+    int found_async = mt.searchBatch(keys, results);
+    mt.set_async_io(nullptr);
+
+    auto endInsert = std::chrono::high_resolution_clock::now();
+    auto durationSync = std::chrono::duration_cast<std::chrono::microseconds>(midInsert - startInsert).count();
+    auto durationInsert = std::chrono::duration_cast<std::chrono::microseconds>(endInsert - midInsert).count();
+    bool ok = found_async >= 0 && results.size() == keys.size();
+    for(int i = 0; ok && i < num; i++){
+        bool hit = mt.search(keys[i], value);
+        ok = results[i].first == (hit ? LOOKUP_FOUND : LOOKUP_ABSENT) && (!hit || results[i].second == value);
+    }
+    std::cout << "one by one " << durationSync << " us (" << found << " found), batched " << durationInsert
+              << " us (" << found_async << " found)" << (ok ? "" : " (mismatch!)") << std::endl;
+    return durationInsert;
+}
+
 
 // 自动化测试
 void test_bplustree(BPlusTree &bpt, int degree, bool clear)
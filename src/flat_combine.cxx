@@ -0,0 +1,159 @@
+#include "flat_combine.h"
+#include "tree.h"
+#include <algorithm>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() std::this_thread::yield()
+#endif
+
+// 合并者最多连续收几轮：收完一批后新发布的操作接着在这一轮中作用，不必等下一个合并者
+static const int COMBINE_PASSES = 3;
+// 等待时先自旋这么多次再让出CPU
+static const int SPIN_LIMIT = 64;
+
+// 每个线程优先使用的槽，线程之间错开，同一个线程反复使用同一个槽
+static std::atomic<int> next_thread_slot{0};
+static thread_local int slot_hint = next_thread_slot.fetch_add(1, std::memory_order_relaxed);
+
+double FlatCombinerStats::avgBatch() const
+{
+    return batches ? (double)ops / batches : 0;
+}
+
+void FlatCombinerStats::print(std::ostream &os) const
+{
+    os << "Flat combiner: ops=" << ops << " batches=" << batches << " avg_batch=" << avgBatch()
+       << " max_batch=" << max_batch << " descents=" << descents << " combines=" << combines << endl;
+}
+
+FlatCombiner::FlatCombiner(BPlusTree &tree, int slots)
+    : tree(tree), slots(std::max(slots, 1))
+{
+}
+
+bool FlatCombiner::insert(const key_type &key, const value_type &value)
+{
+    CombinedOp op{key, CMB_INSERT, &value, nullptr, false};
+    return execute(op);
+}
+
+bool FlatCombiner::upsert(const key_type &key, const value_type &value)
+{
+    CombinedOp op{key, CMB_UPSERT, &value, nullptr, false};
+    return execute(op);
+}
+
+bool FlatCombiner::remove(const key_type &key)
+{
+    CombinedOp op{key, CMB_DELETE, nullptr, nullptr, false};
+    return execute(op);
+}
+
+bool FlatCombiner::search(const key_type &key, value_type &value)
+{
+    CombinedOp op{key, CMB_SEARCH, nullptr, &value, false};
+    return execute(op);
+}
+
+// 占一个空闲的槽：先试本线程上次用的，槽都被占着时（线程数多于槽数）一直找到有空出来的
+FlatCombiner::Slot *FlatCombiner::claim_slot()
+{
+    int n = slots.size();
+    for(int spins = 0; ; spins++){
+        for(int k = 0; k < n; k++){
+            int i = (slot_hint + k) % n;
+            int expected = SLOT_FREE;
+            if(slots[i].state.load(std::memory_order_relaxed) == SLOT_FREE &&
+               slots[i].state.compare_exchange_strong(expected, SLOT_OWNED, std::memory_order_acquire)){
+                slot_hint = i;
+                int used = used_slots.load(std::memory_order_relaxed);
+                while(used <= i && !used_slots.compare_exchange_weak(used, i + 1, std::memory_order_release));
+                return &slots[i];
+            }
+        }
+        if(spins >= SPIN_LIMIT)
+            std::this_thread::yield();
+    }
+}
+
+bool FlatCombiner::try_lock()
+{
+    return !combining.load(std::memory_order_relaxed) && !combining.exchange(true, std::memory_order_acquire);
+}
+
+// 发布操作后等待结果；合并权空着就自己当合并者，连同别人的操作一起执行
+bool FlatCombiner::execute(CombinedOp &op)
+{
+    Slot *slot = claim_slot();
+    slot->op = op;
+    slot->state.store(SLOT_PENDING, std::memory_order_release);
+
+    for(int spins = 0; ; spins++){
+        if(slot->state.load(std::memory_order_acquire) == SLOT_DONE)
+            break;
+        if(try_lock()){
+            combine();
+            combining.store(false, std::memory_order_release);
+            continue;
+        }
+        if(spins < SPIN_LIMIT)
+            CPU_RELAX();
+        else
+            std::this_thread::yield();
+    }
+    bool result = slot->op.result;
+    slot->state.store(SLOT_FREE, std::memory_order_release);
+    return result;
+}
+
+// 合并者：收集待执行的操作，按键排序后成批作用到树上，再把结果交回各槽
+void FlatCombiner::combine()
+{
+    stats.combines++;
+    for(int pass = 0; pass < COMBINE_PASSES; pass++){
+        batch_slots.clear();
+        int n = used_slots.load(std::memory_order_acquire);
+        for(int i = 0; i < n; i++)
+            if(slots[i].state.load(std::memory_order_acquire) == SLOT_PENDING)
+                batch_slots.push_back(&slots[i]);
+        if(batch_slots.empty())
+            break;
+
+        // 按键稳定排序：相同的键保持槽的顺序
+        std::stable_sort(batch_slots.begin(), batch_slots.end(), [](const Slot *a, const Slot *b){
+            return BPlusNode::cmpKeys(a->op.key, b->op.key) < 0;
+        });
+        batch.clear();
+        for(auto s : batch_slots)
+            batch.push_back(&s->op);
+        stats.descents += tree.applyBatch(batch.data(), batch.data() + batch.size());
+        stats.ops += batch.size();
+        stats.batches++;
+        stats.max_batch = std::max<uint64_t>(stats.max_batch, batch.size());
+
+        for(auto s : batch_slots)
+            s->state.store(SLOT_DONE, std::memory_order_release);
+    }
+}
+
+// 统计只由合并者修改，读取时先拿到合并权
+FlatCombinerStats FlatCombiner::getStats()
+{
+    while(!try_lock())
+        std::this_thread::yield();
+    FlatCombinerStats result = stats;
+    combining.store(false, std::memory_order_release);
+    return result;
+}
+
+void FlatCombiner::resetStats()
+{
+    while(!try_lock())
+        std::this_thread::yield();
+    stats = FlatCombinerStats();
+    combining.store(false, std::memory_order_release);
+}
@@ -0,0 +1,220 @@
+#include "hot_cache.h"
+
+double HotCacheStats::hitRate() const
+{
+    uint64_t total = hits + misses;
+    return total ? (double)hits / total : 0.0;
+}
+
+void HotCacheStats::print(std::ostream &os) const
+{
+    os << "Hot-key cache: hits=" << hits << " misses=" << misses
+       << " hit_rate=" << hitRate() * 100 << "%"
+       << " entries=" << entries << "/" << capacity
+       << " admitted=" << admissions << " rejected=" << rejections
+       << " invalidated=" << invalidations
+       << " memory=" << memory_bytes << "B" << endl;
+}
+
+// 槽数向上取整为 WAYS 乘以2的幂；草图每行的计数器数不少于槽数
+HotCache::HotCache(size_t capacity)
+{
+    size_t nbuckets = 1;
+    while(nbuckets * WAYS < capacity)
+        nbuckets <<= 1;
+    buckets.resize(nbuckets);
+    values.resize(nbuckets * WAYS);
+    bucket_mask = nbuckets - 1;
+
+    size_t width = 64;
+    while(width < nbuckets * WAYS)
+        width <<= 1;
+    sketch.assign(width * SKETCH_ROWS, 0);
+    sketch_mask = width - 1;
+    sketch_period = 10 * nbuckets * WAYS;
+}
+
+// splitmix64 终结函数：相邻的整数键也能均匀地落到各个桶
+uint64_t HotCache::hash(const key_type &key)
+{
+    uint64_t h = (uint64_t)(int64_t)key + 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+HotCache::Bucket &HotCache::bucket_of(uint64_t h)
+{
+    return buckets[h & bucket_mask];
+}
+
+int HotCache::find_way(const Bucket &b, const key_type &key) const
+{
+    for(int w = 0; w < WAYS; w++)
+        if((b.valid >> w & 1) && b.keys[w] == key)
+            return w;
+    return -1;
+}
+
+/*******************    频率草图     *********************/
+// 每行用双重哈希取一个计数器，饱和于SKETCH_MAX；累计计数到一个周期后全部减半，让过去的热点逐渐冷却
+void HotCache::increment(uint64_t h)
+{
+    uint64_t step = (h >> 32) | 1;
+    for(int row = 0; row < SKETCH_ROWS; row++){
+        uint8_t &c = sketch[row * (sketch_mask + 1) + ((h + row * step) & sketch_mask)];
+        if(c < SKETCH_MAX)
+            c++;
+    }
+    if(++sketch_additions >= sketch_period){
+        for(auto &c : sketch)
+            c >>= 1;
+        sketch_additions /= 2;
+    }
+}
+
+// 估计频率：各行计数器的最小值
+int HotCache::frequency(uint64_t h) const
+{
+    uint64_t step = (h >> 32) | 1;
+    int freq = SKETCH_MAX;
+    for(int row = 0; row < SKETCH_ROWS; row++)
+        freq = std::min<int>(freq, sketch[row * (sketch_mask + 1) + ((h + row * step) & sketch_mask)]);
+    return freq;
+}
+
+/*******************    查找与准入     *********************/
+// 命中时复制出value并置访问位；未命中时在草图中记一次访问
+bool HotCache::lookup(const key_type &key, value_type &value)
+{
+    uint64_t h = hash(key);
+    Bucket &b = bucket_of(h);
+    int w = find_way(b, key);
+    if(w >= 0){
+        b.referenced |= 1 << w;
+        value = values[(h & bucket_mask) * WAYS + w];
+        counters.hits++;
+        return true;
+    }
+    counters.misses++;
+    increment(h);
+    return false;
+}
+
+// 未命中后从树中查到了value：桶有空槽直接放入，否则与CLOCK选出的被替换者比较估计频率
+void HotCache::admit(const key_type &key, const value_type &value)
+{
+    uint64_t h = hash(key);
+    Bucket &b = bucket_of(h);
+    if(find_way(b, key) >= 0)
+        return;
+
+    int w = 0;
+    if(b.valid != 0xff){
+        for(; b.valid >> w & 1; w++);
+    }
+    else{
+        // CLOCK：跳过并清除访问位，停在第一个最近没有被命中的槽上
+        while(b.referenced >> b.hand & 1){
+            b.referenced &= ~(1 << b.hand);
+            b.hand = (b.hand + 1) % WAYS;
+        }
+        w = b.hand;
+        b.hand = (b.hand + 1) % WAYS;
+        if(frequency(h) <= frequency(hash(b.keys[w]))){
+            counters.rejections++;
+            return;
+        }
+    }
+
+    b.keys[w] = key;
+    b.valid |= 1 << w;
+    b.referenced &= ~(1 << w);
+    values[(h & bucket_mask) * WAYS + w] = value;
+    counters.admissions++;
+}
+
+/*******************    更新与作废     *********************/
+// key的value被改写：已缓存则同步新值，未缓存则不做任何事
+void HotCache::update(const key_type &key, const value_type &value)
+{
+    uint64_t h = hash(key);
+    Bucket &b = bucket_of(h);
+    int w = find_way(b, key);
+    if(w >= 0)
+        values[(h & bucket_mask) * WAYS + w] = value;
+}
+
+// key被删除（或可能不再是查找会找到的那一条）：作废对应的槽
+void HotCache::invalidate(const key_type &key)
+{
+    uint64_t h = hash(key);
+    Bucket &b = bucket_of(h);
+    int w = find_way(b, key);
+    if(w >= 0){
+        b.valid &= ~(1 << w);
+        b.referenced &= ~(1 << w);
+        values[(h & bucket_mask) * WAYS + w].clear();
+        counters.invalidations++;
+    }
+}
+
+// 作废[lo, hi]内的所有键：区间内的键数少于槽数时逐个键探测它所在的桶，
+// 否则区间内的键散落在各个桶中，整表扫一遍更快
+void HotCache::invalidateRange(const key_type &lo, const key_type &hi)
+{
+    if(lo > hi)
+        return;
+    if((uint64_t)((int64_t)hi - lo) + 1 < values.size()){
+        for(int64_t key = lo; key <= hi; key++)
+            invalidate(key);
+        return;
+    }
+    for(size_t i = 0; i < buckets.size(); i++){
+        Bucket &b = buckets[i];
+        for(int w = 0; w < WAYS; w++){
+            if((b.valid >> w & 1) && b.keys[w] >= lo && b.keys[w] <= hi){
+                b.valid &= ~(1 << w);
+                b.referenced &= ~(1 << w);
+                values[i * WAYS + w].clear();
+                counters.invalidations++;
+            }
+        }
+    }
+}
+
+// 清空所有槽，频率草图与计数一并清零
+void HotCache::clear()
+{
+    for(auto &b : buckets)
+        b = Bucket();
+    for(auto &v : values)
+        value_type().swap(v);
+    std::fill(sketch.begin(), sketch.end(), 0);
+    sketch_additions = 0;
+}
+
+/*******************    统计     *********************/
+HotCacheStats HotCache::getStats() const
+{
+    HotCacheStats s = counters;
+    s.capacity = values.size();
+    s.memory_bytes = buckets.size() * sizeof(Bucket) + values.size() * sizeof(value_type) + sketch.size();
+    for(size_t i = 0; i < buckets.size(); i++){
+        for(int w = 0; w < WAYS; w++){
+            const value_type &v = values[i * WAYS + w];
+            // value超出短字符串优化的长度时另有堆内存
+            const char *data = v.data();
+            if(data < (const char *)&v || data >= (const char *)(&v + 1))
+                s.memory_bytes += v.capacity() + 1;
+            if(buckets[i].valid >> w & 1)
+                s.entries++;
+        }
+    }
+    return s;
+}
+
+void HotCache::resetStats()
+{
+    counters = HotCacheStats();
+}
@@ -0,0 +1,172 @@
+#include "learned_index.h"
+
+void LearnedIndexStats::print(std::ostream &os) const
+{
+    os << "Learned index: epsilon=" << epsilon << " leaves=" << leaves << " segments=" << segments
+       << " model=" << model_bytes << "B directory=" << directory_bytes << "B inner_nodes=" << inner_bytes << "B"
+       << " lookups=" << lookups << " window_misses=" << window_misses << " delta_steps=" << delta_steps
+       << " fallbacks=" << fallbacks << " trainings=" << trainings << endl;
+}
+
+LearnedIndex::LearnedIndex(int epsilon): epsilon(epsilon){}
+
+/*******************    训练     *********************/
+// 收集子树中各叶子及其下界：叶子的下界取父节点中它左边的索引键，不必访问叶子本身
+void LearnedIndex::collect(BPlusNode *node, const key_type &lower)
+{
+    for(int i = 0; i <= node->size; i++){
+        const key_type &bound = i == 0 ? lower : node->keys[i-1];
+        BPlusNode *child = node->children[i];
+        if(child->leaf){
+            first_keys.push_back(bound);
+            leaves.push_back(child);
+        }
+        else
+            collect(child, bound);
+    }
+}
+
+// 按当前的树训练：只遍历内部节点收集叶子目录，开销与内部节点数成正比
+// 收缩锥算法：线段起点固定为第一个叶子，每加入一个叶子，就把斜率的可行区间收窄到
+// 使它的预测误差不超过epsilon的范围；区间为空时从这个叶子开始新的线段，最后取区间中点作为斜率
+void LearnedIndex::train(BPlusNode *root)
+{
+    first_keys.clear();
+    leaves.clear();
+    segment_keys.clear();
+    segments.clear();
+    if(root){
+        BPlusNode *first_leaf = root;
+        while(!first_leaf->leaf)
+            first_leaf = first_leaf->children[0];
+        if(first_leaf->size > 0){
+            if(root->leaf){
+                first_keys.push_back(first_leaf->keys[0]);
+                leaves.push_back(first_leaf);
+            }
+            else
+                collect(root, first_leaf->keys[0]);
+        }
+    }
+
+    int n = leaves.size();
+    double lo = 0, hi = 0;
+    for(int i = 0; i < n; i++){
+        if(!segments.empty()){
+            Segment &seg = segments.back();
+            double dx = (double)first_keys[i] - (double)seg.key;
+            if(dx > 0){
+                double lower = (i - epsilon - seg.first) / dx;
+                double upper = (i + epsilon - seg.first) / dx;
+                if(i == seg.first + 1){     // 线段的第二个点：可行区间由它确定
+                    lo = lower;
+                    hi = upper;
+                    continue;
+                }
+                if(std::max(lo, lower) <= std::min(hi, upper)){
+                    lo = std::max(lo, lower);
+                    hi = std::min(hi, upper);
+                    continue;
+                }
+            }
+            seg.slope = i - seg.first > 1 ? (lo + hi) / 2 : 0;
+        }
+        segments.push_back(Segment{first_keys[i], i, 0});
+        segment_keys.push_back(first_keys[i]);
+    }
+    if(!segments.empty() && n - segments.back().first > 1)
+        segments.back().slope = (lo + hi) / 2;
+
+    first_keys.shrink_to_fit();
+    leaves.shrink_to_fit();
+    segment_keys.shrink_to_fit();
+    segments.shrink_to_fit();
+    stale = false;
+    debt = 0;
+    counters.trainings++;
+}
+
+/*******************    查找     *********************/
+// 预测最小键不大于key的最后一个叶子的序号：先二分找线段，再在预测位置的误差窗口内二分
+int LearnedIndex::predict(const key_type &key)
+{
+    int s = std::upper_bound(segment_keys.begin(), segment_keys.end(), key) - segment_keys.begin() - 1;
+    if(s < 0)
+        s = 0;
+    const Segment &seg = segments[s];
+    int end = s + 1 < (int)segments.size() ? segments[s + 1].first : (int)leaves.size();
+
+    double pos = seg.first + seg.slope * ((double)key - (double)seg.key);
+    pos = std::min(std::max(pos, (double)seg.first), (double)(end - 1));
+    int lo = std::max(seg.first, (int)pos - epsilon - 1);
+    int hi = std::min(end - 1, (int)pos + epsilon + 1);
+    int i = std::upper_bound(first_keys.begin() + lo, first_keys.begin() + hi + 1, key) - first_keys.begin() - 1;
+
+    // 训练时保证了误差界，这里只是兜底：窗口没有覆盖到答案时在整个目录中二分
+    if((i < lo && lo > 0) || (i == hi && hi + 1 < (int)first_keys.size() && first_keys[hi + 1] <= key)){
+        counters.window_misses++;
+        i = std::upper_bound(first_keys.begin(), first_keys.end(), key) - first_keys.begin() - 1;
+    }
+    return i < 0 ? 0 : i;
+}
+
+// 返回key所在（或应在）的叶子；模型不可用时返回nullptr，由调用者从根下降
+BPlusNode *LearnedIndex::findLeaf(const key_type &key)
+{
+    if(stale || leaves.empty()){
+        counters.fallbacks++;
+        debt++;
+        return nullptr;
+    }
+
+    counters.lookups++;
+    int i = predict(key);
+    BPlusNode *p = leaves[i];
+    // key小于这个叶子现在的最小键：训练后最小键变大了（删掉了最小键或被左兄弟借走），key可能在左边的叶子中
+    if(p->size == 0 || (i > 0 && BPlusNode::cmpKeys(key, p->keys[0]) < 0)){
+        counters.fallbacks++;
+        debt++;
+        return nullptr;
+    }
+
+    // 增量路径：训练后分裂出来的叶子都在原叶子的右边
+    uint64_t steps = 0;
+    while(p->next_leaf && p->next_leaf->size > 0 && BPlusNode::cmpKeys(p->next_leaf->keys[0], key) <= 0){
+        p = p->next_leaf;
+        steps++;
+    }
+    counters.delta_steps += steps;
+    debt += steps;
+    return p;
+}
+
+// 有叶子被释放：目录中可能有悬空指针，模型作废直到重新训练
+void LearnedIndex::invalidate()
+{
+    stale = true;
+}
+
+// 欠账超过叶子数时重新训练，训练的O(叶子数)开销由之前浪费的查找分摊
+bool LearnedIndex::needsRetrain() const
+{
+    return debt > std::max<size_t>(leaves.size(), 64);
+}
+
+/*******************    统计     *********************/
+LearnedIndexStats LearnedIndex::getStats() const
+{
+    LearnedIndexStats s = counters;
+    s.epsilon = epsilon;
+    s.leaves = leaves.size();
+    s.segments = segments.size();
+    s.model_bytes = segments.capacity() * sizeof(Segment) + segment_keys.capacity() * sizeof(key_type);
+    s.directory_bytes = first_keys.capacity() * sizeof(key_type) + leaves.capacity() * sizeof(BPlusNode*);
+    return s;
+}
+
+void LearnedIndex::resetStats()
+{
+    uint64_t trainings = counters.trainings;
+    counters = LearnedIndexStats();
+    counters.trainings = trainings;
+}
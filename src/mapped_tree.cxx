@@ -0,0 +1,836 @@
+#include "mapped_tree.h"
+#include "tree.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <limits>
+
+static_assert(sizeof(key_type) == 4, "page layout assumes 32-bit keys");
+
+static const uint64_t MAPPED_MAGIC = 0x3130455254505442ULL;    // "BPTREE01"
+static const uint64_t INITIAL_PAGES = 64;
+
+void MappedTreeStats::print(std::ostream &os) const
+{
+    os << "Mapped tree: keys=" << keys << " height=" << height << " pages=" << pages
+       << " free_pages=" << free_pages << " file=" << file_bytes << "B"
+       << " commits=" << commits << " cow_copies=" << cow_copies
+       << " page_reads=" << page_reads << " read_errors=" << read_errors << " prefetched=" << prefetched_pages << endl;
+}
+
+MappedTree::~MappedTree()
+{
+    close();
+}
+
+/*******************    页     *********************/
+char *MappedTree::page(uint64_t id) const
+{
+    return base + id * PAGE_SIZE;
+}
+
+MappedTree::PageHeader *MappedTree::header(uint64_t id) const
+{
+    return (PageHeader *)page(id);
+}
+
+// 内部节点：键紧跟页头，孩子页号放在页尾
+key_type *MappedTree::inner_keys(uint64_t id) const
+{
+    return (key_type *)(page(id) + sizeof(PageHeader));
+}
+
+uint64_t *MappedTree::inner_children(uint64_t id) const
+{
+    return (uint64_t *)(page(id) + CHILDREN_OFFSET);
+}
+
+// 叶子：槽（键、value的位置与长度）紧跟页头往后长，value从页尾往前长
+MappedTree::LeafSlot *MappedTree::leaf_slots(uint64_t id) const
+{
+    return (LeafSlot *)(page(id) + sizeof(PageHeader));
+}
+
+/*******************    打开与关闭     *********************/
+// FNV-1a
+uint64_t MappedTree::checksum(const Meta &m)
+{
+    const unsigned char *p = (const unsigned char *)&m;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < offsetof(Meta, checksum); i++){
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool MappedTree::read_meta(int slot, Meta &m) const
+{
+    memcpy(&m, page(slot), sizeof(Meta));
+    return m.magic == MAPPED_MAGIC && m.checksum == checksum(m) && m.page_count * PAGE_SIZE <= mapped;
+}
+
+// 只映射文件并取出较新的有效超级块，不读任何节点；空文件则初始化
+bool MappedTree::open(const string &file_name)
+{
+    close();
+    fd = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        std::cerr << "Error: open mapped tree failed: cannot open " << file_name << endl;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        std::cerr << "Error: open mapped tree failed: cannot stat " << file_name << endl;
+        close();
+        return false;
+    }
+    bool fresh = st.st_size == 0;
+    // 至少要有两个超级块，且由整页组成，否则不是映射树文件（或被截断了），不能去读超级块
+    if(!fresh && (st.st_size < 2 * PAGE_SIZE || st.st_size % PAGE_SIZE != 0)){
+        std::cerr << "Error: open mapped tree failed: " << file_name << " has invalid size " << st.st_size << "!" << endl;
+        close();
+        return false;
+    }
+    if(fresh && ftruncate(fd, INITIAL_PAGES * PAGE_SIZE) != 0){
+        std::cerr << "Error: open mapped tree failed: cannot extend " << file_name << endl;
+        close();
+        return false;
+    }
+    mapped = fresh ? INITIAL_PAGES * PAGE_SIZE : st.st_size;
+    void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED){
+        std::cerr << "Error: open mapped tree failed: mmap " << file_name << endl;
+        base = nullptr;
+        close();
+        return false;
+    }
+    base = (char *)p;
+    this->file_name = file_name;
+
+    if(fresh){
+        memset(&meta, 0, sizeof(Meta));
+        meta.magic = MAPPED_MAGIC;
+        meta.page_count = 2;
+        meta.checksum = checksum(meta);
+        memcpy(page(0), &meta, sizeof(Meta));
+        msync(base, PAGE_SIZE, MS_SYNC);
+        meta_slot = 0;
+    }
+    else{
+        Meta m[2];
+        bool ok[2] = {read_meta(0, m[0]), read_meta(1, m[1])};
+        if(!ok[0] && !ok[1]){
+            std::cerr << "Error: open mapped tree failed: " << file_name << " has no valid superblock!" << endl;
+            close();
+            return false;
+        }
+        meta_slot = ok[0] && (!ok[1] || m[0].seq > m[1].seq) ? 0 : 1;
+        meta = m[meta_slot];
+    }
+    txn = meta.seq + 1;
+    modified = false;
+    free_loaded = false;
+    commits = cow_copies = page_reads = read_errors = prefetched_pages = 0;
+    return true;
+}
+
+// 未提交的修改被丢弃：它们写在已提交的树引用不到的页上
+void MappedTree::close()
+{
+    if(io && async_lookups > 0)     // 在途的查找还会读这个文件
+        io->drain();
+    if(base)
+        munmap(base, mapped);
+    if(fd >= 0)
+        ::close(fd);
+    base = nullptr;
+    fd = -1;
+    mapped = 0;
+    free_pages.clear();
+    pending_free.clear();
+    freelist_pages.clear();
+    dirty_pages.clear();
+    free_loaded = false;
+}
+
+bool MappedTree::isOpen() const
+{
+    return base != nullptr;
+}
+
+/*******************    页的分配     *********************/
+// 文件至少能容纳pages页：按倍增扩展文件并重新映射，映射地址可能改变
+bool MappedTree::grow(uint64_t pages)
+{
+    if(pages * PAGE_SIZE <= mapped)
+        return true;
+    size_t size = std::max<size_t>(pages * PAGE_SIZE, mapped * 2);
+    if(ftruncate(fd, size) != 0){
+        std::cerr << "Error: grow mapped tree failed: cannot extend " << file_name << endl;
+        return false;
+    }
+    void *p = mremap(base, mapped, size, MREMAP_MAYMOVE);
+    if(p == MAP_FAILED){
+        std::cerr << "Error: grow mapped tree failed: mremap " << file_name << endl;
+        return false;
+    }
+    base = (char *)p;
+    mapped = size;
+    return true;
+}
+
+// 一次修改开始前预留足够的页，修改过程中不再重新映射，页指针一直有效
+bool MappedTree::reserve(uint64_t pages)
+{
+    load_free_list();
+    uint64_t from_file = pages > free_pages.size() ? pages - free_pages.size() : 0;
+    return grow(meta.page_count + from_file);
+}
+
+// 第一次修改时才沿链表读入空闲页，打开只读的树时不碰这些页
+void MappedTree::load_free_list()
+{
+    if(free_loaded)
+        return;
+    free_loaded = true;
+    for(uint64_t id = meta.free_head; id; ){
+        freelist_pages.push_back(id);
+        uint64_t *words = (uint64_t *)(page(id) + sizeof(PageHeader));
+        uint64_t next = words[0], n = words[1];
+        free_pages.insert(free_pages.end(), words + 2, words + 2 + n);
+        id = next;
+    }
+}
+
+uint64_t MappedTree::alloc_page(bool leaf)
+{
+    uint64_t id;
+    if(!free_pages.empty()){
+        id = free_pages.back();
+        free_pages.pop_back();
+    }
+    else
+        id = meta.page_count++;
+    PageHeader *h = header(id);
+    memset(h, 0, sizeof(PageHeader));
+    h->leaf = leaf;
+    h->data_start = PAGE_SIZE;
+    h->txn = txn;
+    dirty_pages.push_back(id);
+    return id;
+}
+
+// 本事务分配的页可以立即复用；已提交的页在提交前仍被旧的树引用
+void MappedTree::free_page(uint64_t id)
+{
+    if(header(id)->txn == txn)
+        free_pages.push_back(id);
+    else
+        pending_free.push_back(id);
+}
+
+// 写时复制：已提交的页复制到新页，返回可以原地修改的页号
+uint64_t MappedTree::writable(uint64_t id)
+{
+    if(header(id)->txn == txn)
+        return id;
+    uint64_t copy = alloc_page(header(id)->leaf);
+    memcpy(page(copy), page(id), PAGE_SIZE);
+    header(copy)->txn = txn;
+    pending_free.push_back(id);
+    cow_copies++;
+    return copy;
+}
+
+/*******************    节点内的操作     *********************/
+// 叶子中第一个不小于key的位置；p可以是映射中的页，也可以是读进缓冲区的页
+int MappedTree::leaf_find(const char *p, const key_type &key)
+{
+    const LeafSlot *slots = (const LeafSlot *)(p + sizeof(PageHeader));
+    int lo = 0, hi = ((const PageHeader *)p)->count;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(slots[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// 内部节点中key应走向的孩子：不大于key的索引键个数
+int MappedTree::child_index(const char *p, const key_type &key)
+{
+    const key_type *keys = (const key_type *)(p + sizeof(PageHeader));
+    return std::upper_bound(keys, keys + ((const PageHeader *)p)->count, key) - keys;
+}
+
+uint64_t MappedTree::child_at(const char *p, int index)
+{
+    return ((const uint64_t *)(p + CHILDREN_OFFSET))[index];
+}
+
+int MappedTree::leaf_space(uint64_t id) const
+{
+    const PageHeader *h = header(id);
+    return h->data_start - (int)sizeof(PageHeader) - h->count * (int)sizeof(LeafSlot);
+}
+
+// 删掉槽，value占的字节要等整页重写时才回收
+void MappedTree::leaf_erase(uint64_t id, int pos)
+{
+    PageHeader *h = header(id);
+    LeafSlot *slots = leaf_slots(id);
+    memmove(slots + pos, slots + pos + 1, (h->count - pos - 1) * sizeof(LeafSlot));
+    h->count--;
+}
+
+// 调用者保证空间足够
+void MappedTree::leaf_insert(uint64_t id, int pos, const key_type &key, const value_type &value)
+{
+    PageHeader *h = header(id);
+    LeafSlot *slots = leaf_slots(id);
+    memmove(slots + pos + 1, slots + pos, (h->count - pos) * sizeof(LeafSlot));
+    h->data_start -= value.size();
+    memcpy(page(id) + h->data_start, value.data(), value.size());
+    slots[pos] = LeafSlot{key, h->data_start, (uint16_t)value.size()};
+    h->count++;
+}
+
+// 用entries[first, last)重写整个叶子
+void MappedTree::leaf_fill(uint64_t id, const vector<std::pair<key_type, value_type>> &entries, size_t first, size_t last)
+{
+    PageHeader *h = header(id);
+    h->count = 0;
+    h->data_start = PAGE_SIZE;
+    for(size_t i = first; i < last; i++)
+        leaf_insert(id, h->count, entries[i].first, entries[i].second);
+}
+
+void MappedTree::leaf_entries(uint64_t id, vector<std::pair<key_type, value_type>> &entries) const
+{
+    const LeafSlot *slots = leaf_slots(id);
+    for(int i = 0; i < header(id)->count; i++)
+        entries.emplace_back(slots[i].key, value_type(page(id) + slots[i].offset, slots[i].length));
+}
+
+// 用keys[first, last)与children[first, last+1]重写整个内部节点
+void MappedTree::inner_fill(uint64_t id, const vector<key_type> &keys, const vector<uint64_t> &children, size_t first, size_t last)
+{
+    header(id)->count = last - first;
+    std::copy(keys.begin() + first, keys.begin() + last, inner_keys(id));
+    std::copy(children.begin() + first, children.begin() + last + 1, inner_children(id));
+}
+
+/*******************    查询     *********************/
+bool MappedTree::search(const key_type &key, value_type &value)
+{
+    if(!base || meta.root == 0)
+        return false;
+    uint64_t id = meta.root;
+    while(!header(id)->leaf)
+        id = inner_children(id)[child_index(page(id), key)];
+    int pos = leaf_find(page(id), key);
+    if(pos == header(id)->count || leaf_slots(id)[pos].key != key)
+        return false;
+    const LeafSlot &s = leaf_slots(id)[pos];
+    value.assign(page(id) + s.offset, s.length);
+    return true;
+}
+
+// 从第一个不小于start_key的键开始读取至多count个键值对；叶子读完后沿路径栈回到最近一个还有右孩子的祖先
+int MappedTree::scan(const key_type &start_key, int count, vector<std::pair<key_type, value_type>> &result)
+{
+    result.clear();
+    if(!base || meta.root == 0 || count <= 0)
+        return 0;
+    vector<std::pair<uint64_t, int>> path;
+    uint64_t id = meta.root;
+    while(!header(id)->leaf){
+        int i = child_index(page(id), start_key);
+        path.emplace_back(id, i);
+        id = inner_children(id)[i];
+    }
+    int pos = leaf_find(page(id), start_key);
+    uint64_t fetched_parent = 0;
+    int fetched_to = 0;
+    while(true){
+        if(io && !path.empty()){    // 按还需要的键数估计后面要读几个叶子
+            int need = (count - (int)result.size() - (header(id)->count - pos)) / std::max<int>(1, header(id)->count) + 1;
+            prefetch_siblings(path.back().first, path.back().second, need, fetched_parent, fetched_to);
+        }
+        const LeafSlot *slots = leaf_slots(id);
+        for(; pos < header(id)->count && (int)result.size() < count; pos++)
+            result.emplace_back(slots[pos].key, value_type(page(id) + slots[pos].offset, slots[pos].length));
+        if((int)result.size() == count)
+            break;
+        while(!path.empty() && path.back().second == header(path.back().first)->count)
+            path.pop_back();
+        if(path.empty())
+            break;
+        id = inner_children(path.back().first)[++path.back().second];
+        while(!header(id)->leaf){
+            path.emplace_back(id, 0);
+            id = inner_children(id)[0];
+        }
+        pos = 0;
+    }
+    return result.size();
+}
+
+/*******************    插入     *********************/
+// 插入或覆盖；value超过MAX_VALUE时失败
+bool MappedTree::put(const key_type &key, const value_type &value)
+{
+    if(!base){
+        std::cerr << "Error: put failed: mapped tree is not open!" << endl;
+        return false;
+    }
+    if(async_lookups > 0){
+        std::cerr << "Error: put failed: asynchronous lookups are still in flight!" << endl;
+        return false;
+    }
+    if(value.size() > MAX_VALUE){
+        std::cerr << "Error: put failed: value of key '" << key << "' is longer than " << MAX_VALUE << " bytes!" << endl;
+        return false;
+    }
+    // 最坏情况：每一层复制一页、分裂出一页，再加一个新根
+    if(!reserve(2 * meta.height + 3))
+        return false;
+    if(meta.root == 0){
+        meta.root = alloc_page(true);
+        meta.height = 1;
+    }
+
+    bool inserted = false, split = false;
+    key_type sep;
+    uint64_t right;
+    uint64_t r = put_rec(meta.root, key, value, inserted, split, sep, right);
+    if(split){
+        uint64_t new_root = alloc_page(false);
+        header(new_root)->count = 1;
+        inner_keys(new_root)[0] = sep;
+        inner_children(new_root)[0] = r;
+        inner_children(new_root)[1] = right;
+        r = new_root;
+        meta.height++;
+    }
+    meta.root = r;
+    if(inserted)
+        meta.key_count++;
+    modified = true;
+    return true;
+}
+
+// 在以id为根的子树中插入，返回子树新的根页号；子树分裂时split为true，sep与right为新右兄弟的最小键与页号
+uint64_t MappedTree::put_rec(uint64_t id, const key_type &key, const value_type &value, bool &inserted,
+                             bool &split, key_type &sep, uint64_t &right)
+{
+    id = writable(id);
+    split = false;
+
+    if(header(id)->leaf){
+        int pos = leaf_find(page(id), key);
+        bool exists = pos < header(id)->count && leaf_slots(id)[pos].key == key;
+        inserted = !exists;
+        if(exists){
+            LeafSlot &s = leaf_slots(id)[pos];
+            if(value.size() <= s.length){   // 新value不更长：原地覆盖
+                memcpy(page(id) + s.offset, value.data(), value.size());
+                s.length = value.size();
+                return id;
+            }
+            leaf_erase(id, pos);
+        }
+        int need = sizeof(LeafSlot) + value.size();
+        if(leaf_space(id) < need){      // 先整页重写回收碎片
+            vector<std::pair<key_type, value_type>> entries;
+            leaf_entries(id, entries);
+            leaf_fill(id, entries, 0, entries.size());
+        }
+        if(leaf_space(id) >= need){
+            leaf_insert(id, pos, key, value);
+            return id;
+        }
+
+        // 放不下：连同新键值对按字节数均分到两个叶子
+        vector<std::pair<key_type, value_type>> entries;
+        leaf_entries(id, entries);
+        entries.insert(entries.begin() + pos, std::make_pair(key, value));
+        size_t total = 0, half = 0, mid = 0;
+        for(auto &e : entries)
+            total += sizeof(LeafSlot) + e.second.size();
+        for(; mid < entries.size() - 1 && half + sizeof(LeafSlot) + entries[mid].second.size() <= total / 2; mid++)
+            half += sizeof(LeafSlot) + entries[mid].second.size();
+        mid = std::max<size_t>(mid, 1);
+        right = alloc_page(true);
+        leaf_fill(id, entries, 0, mid);
+        leaf_fill(right, entries, mid, entries.size());
+        sep = entries[mid].first;
+        split = true;
+        return id;
+    }
+
+    int i = child_index(page(id), key);
+    bool child_split;
+    key_type child_sep;
+    uint64_t child_right;
+    inner_children(id)[i] = put_rec(inner_children(id)[i], key, value, inserted, child_split, child_sep, child_right);
+    if(!child_split)
+        return id;
+
+    int n = header(id)->count;
+    key_type *keys = inner_keys(id);
+    uint64_t *children = inner_children(id);
+    if(n < INNER_MAX_KEYS){
+        memmove(keys + i + 1, keys + i, (n - i) * sizeof(key_type));
+        memmove(children + i + 2, children + i + 1, (n - i) * sizeof(uint64_t));
+        keys[i] = child_sep;
+        children[i + 1] = child_right;
+        header(id)->count++;
+        return id;
+    }
+
+    // 内部节点满了：中间的键提到父节点
+    vector<key_type> all_keys(keys, keys + n);
+    vector<uint64_t> all_children(children, children + n + 1);
+    all_keys.insert(all_keys.begin() + i, child_sep);
+    all_children.insert(all_children.begin() + i + 1, child_right);
+    size_t mid = all_keys.size() / 2;
+    right = alloc_page(false);
+    inner_fill(id, all_keys, all_children, 0, mid);
+    inner_fill(right, all_keys, all_children, mid + 1, all_keys.size());
+    sep = all_keys[mid];
+    split = true;
+    return id;
+}
+
+/*******************    删除     *********************/
+bool MappedTree::remove(const key_type &key)
+{
+    if(async_lookups > 0){
+        std::cerr << "Error: remove failed: asynchronous lookups are still in flight!" << endl;
+        return false;
+    }
+    value_type value;
+    if(!search(key, value)){    // 先确认存在，不存在时不复制任何页
+        std::cerr << "Error: remove failed: key '" << key << "' doesn't exist!" << endl;
+        return false;
+    }
+    if(!reserve(meta.height + 1))
+        return false;
+    meta.root = remove_rec(meta.root, key);
+    // 根只剩一个孩子时降低一层
+    while(meta.root && !header(meta.root)->leaf && header(meta.root)->count == 0){
+        uint64_t old = meta.root;
+        meta.root = inner_children(old)[0];
+        free_page(old);
+        meta.height--;
+    }
+    if(meta.root == 0)
+        meta.height = 0;
+    meta.key_count--;
+    modified = true;
+    return true;
+}
+
+// 在以id为根的子树中删除key（调用者保证存在），返回子树新的根页号；子树删空时释放并返回0
+uint64_t MappedTree::remove_rec(uint64_t id, const key_type &key)
+{
+    id = writable(id);
+    if(header(id)->leaf){
+        leaf_erase(id, leaf_find(page(id), key));
+        if(header(id)->count > 0)
+            return id;
+        free_page(id);
+        return 0;
+    }
+
+    int i = child_index(page(id), key);
+    uint64_t child = remove_rec(inner_children(id)[i], key);
+    if(child){
+        inner_children(id)[i] = child;
+        return id;
+    }
+
+    // 孩子删空：摘掉孩子及其一侧的索引键，它的键区间并入相邻的孩子
+    int n = header(id)->count;
+    if(n == 0){
+        free_page(id);
+        return 0;
+    }
+    key_type *keys = inner_keys(id);
+    uint64_t *children = inner_children(id);
+    int k = i > 0 ? i - 1 : 0;
+    memmove(keys + k, keys + k + 1, (n - k - 1) * sizeof(key_type));
+    memmove(children + i, children + i + 1, (n - i) * sizeof(uint64_t));
+    header(id)->count--;
+    return id;
+}
+
+/*******************    提交     *********************/
+// 把本事务的修改持久化：新页落盘后再写超级块，超级块写完才算提交成功
+bool MappedTree::commit()
+{
+    if(!base)
+        return false;
+    if(async_lookups > 0){
+        std::cerr << "Error: commit failed: asynchronous lookups are still in flight!" << endl;
+        return false;
+    }
+    if(!modified)
+        return true;
+
+    // 新的空闲链表 = 可复用的页 + 本事务换下的页 + 旧空闲链表本身占的页；链表页从可复用的页中取
+    load_free_list();
+    uint64_t total = free_pages.size() + pending_free.size() + freelist_pages.size();
+    if(!reserve(total / FREELIST_CAP + 2))
+        return false;
+    vector<uint64_t> list_pages;
+    while(list_pages.size() * FREELIST_CAP < free_pages.size() + pending_free.size() + freelist_pages.size())
+        list_pages.push_back(alloc_page(false));
+    vector<uint64_t> ids = free_pages;
+    ids.insert(ids.end(), pending_free.begin(), pending_free.end());
+    ids.insert(ids.end(), freelist_pages.begin(), freelist_pages.end());
+    for(size_t p = 0; p < list_pages.size(); p++){
+        uint64_t *words = (uint64_t *)(page(list_pages[p]) + sizeof(PageHeader));
+        size_t first = p * FREELIST_CAP, n = std::min<size_t>(FREELIST_CAP, ids.size() - first);
+        words[0] = p + 1 < list_pages.size() ? list_pages[p + 1] : 0;
+        words[1] = n;
+        std::copy(ids.begin() + first, ids.begin() + first + n, words + 2);
+    }
+
+    if(io ? !writeback() : msync(base, meta.page_count * PAGE_SIZE, MS_SYNC) != 0){
+        std::cerr << "Error: commit failed: cannot write back pages of " << file_name << endl;
+        return false;
+    }
+    Meta next = meta;
+    next.seq = txn;
+    next.free_head = list_pages.empty() ? 0 : list_pages[0];
+    next.free_count = ids.size();
+    next.checksum = checksum(next);
+    int slot = meta_slot ^ 1;
+    memcpy(page(slot), &next, sizeof(Meta));
+    if(msync(page(slot), PAGE_SIZE, MS_SYNC) != 0){
+        std::cerr << "Error: commit failed: msync superblock of " << file_name << endl;
+        return false;
+    }
+
+    meta = next;
+    meta_slot = slot;
+    txn++;
+    free_pages.swap(ids);
+    pending_free.clear();
+    freelist_pages.swap(list_pages);
+    dirty_pages.clear();
+    modified = false;
+    commits++;
+    return true;
+}
+
+/*******************    异步I/O     *********************/
+// 挂上异步I/O层（nullptr表示摘下）；prefetch_leaves为范围查询最多预读的兄弟叶子数
+void MappedTree::set_async_io(AsyncIO *io, int prefetch_leaves)
+{
+    if(this->io && async_lookups > 0)
+        this->io->drain();
+    this->io = io;
+    this->prefetch_leaves = prefetch_leaves;
+}
+
+// 页是否在页缓存中：在则经映射直接读，只有次缺页中断
+bool MappedTree::resident(uint64_t id) const
+{
+    unsigned char in_core = 0;
+    uintptr_t addr = (uintptr_t)page(id) & ~(uintptr_t)(system_page - 1);
+    return mincore((void *)addr, system_page, &in_core) == 0 && (in_core & 1);
+}
+
+// 发起一个查找，不等待：在页缓存中的页立即往下走，遇到缺页时交给异步I/O，完成后从那一页继续
+// done在查找结束时调用，可能就在本函数中，也可能在之后的AsyncIO::poll()/drain()中
+void MappedTree::searchAsync(const key_type &key, LookupDone done)
+{
+    if(!base){
+        done(LOOKUP_ERROR, value_type());
+        return;
+    }
+    if(meta.root == 0){
+        done(LOOKUP_ABSENT, value_type());
+        return;
+    }
+    if(!io){
+        value_type value;
+        bool found = search(key, value);
+        done(found ? LOOKUP_FOUND : LOOKUP_ABSENT, value);
+        return;
+    }
+    std::shared_ptr<AsyncLookup> lookup(new AsyncLookup{key, std::move(done)});
+    async_lookups++;
+    lookup_from(lookup, meta.root);
+}
+
+void MappedTree::lookup_from(std::shared_ptr<AsyncLookup> lookup, uint64_t id)
+{
+    while(resident(id)){
+        const char *p = page(id);
+        if(((const PageHeader *)p)->leaf){
+            finish_lookup(lookup, p);
+            return;
+        }
+        id = child_at(p, child_index(p, lookup->key));
+    }
+
+    auto it = fetches.find(id);
+    if(it != fetches.end()){    // 这一页已经在读了
+        it->second.waiters.push_back(std::move(lookup));
+        return;
+    }
+    PageFetch &fetch = fetches[id];
+    fetch.buf.reset(new char[PAGE_SIZE]);
+    fetch.waiters.push_back(std::move(lookup));
+    page_reads++;
+    io->read(fd, fetch.buf.get(), PAGE_SIZE, id * PAGE_SIZE, [this, id](int res){ fetch_done(id, res); });
+}
+
+// 页读完：挂在上面的查找各自在这一页中继续
+void MappedTree::fetch_done(uint64_t id, int res)
+{
+    auto it = fetches.find(id);
+    PageFetch fetch = std::move(it->second);
+    fetches.erase(it);
+    if(res != PAGE_SIZE)
+        read_errors++;
+    for(auto &lookup : fetch.waiters){
+        if(res != PAGE_SIZE)
+            finish_lookup(lookup, nullptr, LOOKUP_ERROR);
+        else
+            lookup_page(lookup, fetch.buf.get());
+    }
+}
+
+void MappedTree::lookup_page(std::shared_ptr<AsyncLookup> lookup, const char *p)
+{
+    if(((const PageHeader *)p)->leaf)
+        finish_lookup(lookup, p);
+    else
+        lookup_from(lookup, child_at(p, child_index(p, lookup->key)));
+}
+
+// p为查找到达的叶子，为nullptr时以status结束（读页失败为LOOKUP_ERROR）
+void MappedTree::finish_lookup(const std::shared_ptr<AsyncLookup> &lookup, const char *p, LookupStatus status)
+{
+    async_lookups--;
+    if(p){
+        int pos = leaf_find(p, lookup->key);
+        const LeafSlot *slots = (const LeafSlot *)(p + sizeof(PageHeader));
+        if(pos < ((const PageHeader *)p)->count && slots[pos].key == lookup->key){
+            lookup->done(LOOKUP_FOUND, value_type(p + slots[pos].offset, slots[pos].length));
+            return;
+        }
+    }
+    lookup->done(status, value_type());
+}
+
+// 一批查找同时发起，缺的页合成几批提交；返回找到的个数，有查找因读页失败而没有结果时返回-1（各自的结果见results）
+int MappedTree::searchBatch(const vector<key_type> &keys, vector<std::pair<LookupStatus, value_type>> &results)
+{
+    results.assign(keys.size(), std::make_pair(LOOKUP_ABSENT, value_type()));
+    int found = 0, failed = 0;
+    for(size_t i = 0; i < keys.size(); i++){
+        searchAsync(keys[i], [&results, &found, &failed, i](LookupStatus status, const value_type &value){
+            results[i].first = status;
+            results[i].second = value;
+            found += status == LOOKUP_FOUND;
+            failed += status == LOOKUP_ERROR;
+        });
+    }
+    if(io)
+        io->drain();
+    return failed ? -1 : found;
+}
+
+// 预读parent中index之后的至多leaves个孩子；编号连续的页合成一个请求，已预读过的不再重复
+void MappedTree::prefetch_siblings(uint64_t parent, int index, int leaves, uint64_t &fetched_parent, int &fetched_to)
+{
+    if(prefetch_leaves <= 0)
+        return;
+    if(parent != fetched_parent){
+        fetched_parent = parent;
+        fetched_to = index;
+    }
+    int last = std::min<int>(header(parent)->count, index + std::min(leaves, prefetch_leaves));
+    uint64_t run_start = 0, run_length = 0;
+    for(int j = std::max(fetched_to, index) + 1; j <= last; j++){
+        uint64_t child = inner_children(parent)[j];
+        if(resident(child))
+            continue;
+        if(run_length && child == run_start + run_length)
+            run_length++;
+        else{
+            if(run_length)
+                io->prefetch(fd, run_start * PAGE_SIZE, run_length * PAGE_SIZE);
+            run_start = child;
+            run_length = 1;
+        }
+        prefetched_pages++;
+    }
+    if(run_length)
+        io->prefetch(fd, run_start * PAGE_SIZE, run_length * PAGE_SIZE);
+    fetched_to = std::max(fetched_to, last);
+    io->poll(0);    // 交出预读请求，顺便收割已完成的
+}
+
+// 把本事务写过的页按页号排序，合并成连续的段，所有段一起提交写回，最后一次fdatasync落盘
+bool MappedTree::writeback()
+{
+    static const uint64_t MAX_RUN = 16384;     // 每个请求最多写回的页数
+    std::sort(dirty_pages.begin(), dirty_pages.end());
+    dirty_pages.erase(std::unique(dirty_pages.begin(), dirty_pages.end()), dirty_pages.end());
+    bool failed = false;
+    for(size_t i = 0; i < dirty_pages.size(); ){
+        size_t j = i + 1;
+        while(j < dirty_pages.size() && dirty_pages[j] == dirty_pages[j - 1] + 1 && j - i < MAX_RUN)
+            j++;
+        io->syncRange(fd, dirty_pages[i] * PAGE_SIZE, (j - i) * PAGE_SIZE, [&failed](int res){
+            if(res < 0)
+                failed = true;
+        });
+        i = j;
+    }
+    io->drain();
+    return !failed && fdatasync(fd) == 0;
+}
+
+/*******************    导入与统计     *********************/
+// 把内存中的树按键序逐条写入，返回写入的键数（不提交）
+int MappedTree::importFrom(BPlusTree &bpt)
+{
+    int imported = 0;
+    bpt.scanBlocks(std::numeric_limits<key_type>::min(), std::numeric_limits<key_type>::max(), [&](const LeafSpan &span){
+        for(int i = 0; i < span.size; i++)
+            imported += put(span.keys[i], span.values[i]);
+        return true;
+    });
+    return imported;
+}
+
+MappedTreeStats MappedTree::getStats()
+{
+    MappedTreeStats s;
+    if(!base)
+        return s;
+    s.keys = meta.key_count;
+    s.height = meta.height;
+    s.pages = meta.page_count;
+    s.free_pages = free_loaded ? free_pages.size() + pending_free.size() : meta.free_count;
+    s.file_bytes = mapped;
+    s.commits = commits;
+    s.cow_copies = cow_copies;
+    s.page_reads = page_reads;
+    s.read_errors = read_errors;
+    s.prefetched_pages = prefetched_pages;
+    return s;
+}
@@ -1,4 +1,5 @@
 #include "node.h"
+#include "tiering.h"
     
 BPlusNode::BPlusNode(){}
 BPlusNode::BPlusNode(bool leaf, int size): leaf(leaf), size(size){}
@@ -7,7 +8,9 @@ BPlusNode::BPlusNode(bool leaf, int size, vector<key_type> &keys_vec, vector<BPl
 BPlusNode::BPlusNode(bool leaf, int size, vector<key_type> &keys_vec, vector<value_type> &value_vec): 
         leaf(leaf), size(size), keys(keys_vec), values(value_vec){}
 
-BPlusNode::~BPlusNode(){}
+BPlusNode::~BPlusNode(){
+    delete cold;
+}
 
 
 // 键值的比较
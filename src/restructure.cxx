@@ -0,0 +1,157 @@
+#include "restructure.h"
+
+void RestructureStats::print(std::ostream &os) const
+{
+    os << "Restructure: leaf_degree=" << leaf_degree << " nonleaf_degree=" << nonleaf_degree
+       << " state=" << (copied ? "copied" : active ? "copying" : "idle")
+       << " steps=" << steps << " leaves_copied=" << leaves_copied << " keys_copied=" << keys_copied
+       << " logged_ranges=" << logged_ranges << " repaired_keys=" << repaired_keys << endl;
+}
+
+Restructure::Restructure(int leaf_degree, int nonleaf_degree)
+    : builder(leaf_degree, nonleaf_degree)
+{
+    stats.leaf_degree = leaf_degree;
+    stats.nonleaf_degree = nonleaf_degree;
+    stats.active = true;
+}
+
+TreeBuilder::TreeBuilder(int leaf_degree, int nonleaf_degree)
+    : leaf_degree(leaf_degree), nonleaf_degree(nonleaf_degree)
+{
+}
+
+// 没有被finish取走的节点一并释放：所有节点都挂在最右路径的根下
+TreeBuilder::~TreeBuilder()
+{
+    if(spine.empty())
+        return;
+    vector<BPlusNode*> stack;
+    stack.push_back(spine.back());
+    while(!stack.empty()){
+        BPlusNode *p = stack.back();
+        stack.pop_back();
+        if(!p->isLeaf())
+            stack.insert(stack.end(), p->children.begin(), p->children.end());
+        delete p;
+    }
+}
+
+BPlusNode *TreeBuilder::new_node(bool leaf)
+{
+    BPlusNode *node = new BPlusNode(leaf, 0);
+    if(leaf){
+        node->keys.reserve(leaf_degree);
+        node->values.reserve(leaf_degree);
+    }
+    else{
+        node->keys.reserve(nonleaf_degree);
+        node->children.reserve(nonleaf_degree + 1);
+    }
+    return node;
+}
+
+// 追加一个键值对，键不能小于之前追加的；返回它落入的叶子
+BPlusNode *TreeBuilder::add(const key_type &key, const value_type &value)
+{
+    if(spine.empty()){
+        spine.push_back(new_node(true));
+        leaf_count++;
+    }
+    else if(spine[0]->size == leaf_degree - 1){     // 叶子满了：开下一个，key作为两者之间的索引
+        BPlusNode *prev = spine[0], *leaf = new_node(true);
+        prev->next_leaf = leaf;
+        spine[0] = leaf;
+        leaf_count++;
+        push_up(1, key, prev, leaf);
+    }
+    BPlusNode *leaf = spine[0];
+    leaf->keys.push_back(key);
+    leaf->values.push_back(value);
+    leaf->size++;
+    key_count++;
+    return leaf;
+}
+
+// 第level-1层新开了节点right（左边是left），把分隔键sep加到第level层最右的节点中；它满了则同样开新节点并继续往上
+void TreeBuilder::push_up(size_t level, const key_type &sep, BPlusNode *left, BPlusNode *right)
+{
+    if(level == spine.size()){      // 长出新的一层
+        BPlusNode *node = new_node(false);
+        node->children.push_back(left);
+        spine.push_back(node);
+    }
+    BPlusNode *node = spine[level];
+    if((int)node->children.size() == nonleaf_degree){
+        BPlusNode *next = new_node(false);
+        next->children.push_back(right);
+        spine[level] = next;
+        push_up(level + 1, sep, node, next);
+    }
+    else{
+        node->keys.push_back(sep);
+        node->children.push_back(right);
+        node->size++;
+    }
+}
+
+// 最右路径上的节点可能不足半满（刚开的内部节点甚至只有一个孩子）：自顶向下处理，
+// 上一层处理完至少有两个孩子，下一层最右的节点一定有左兄弟，而左兄弟都是装满后才关上的，匀给它一半后两边都不下溢
+void TreeBuilder::fix_right_edge()
+{
+    int leaf_min = (leaf_degree + 1) / 2 - 1;
+    int nonleaf_min = std::max((nonleaf_degree + 1) / 2 - 1, 1);
+    for(int level = (int)spine.size() - 2; level >= 0; level--){
+        BPlusNode *parent = spine[level + 1], *node = spine[level];
+        BPlusNode *left = parent->children[parent->size - 1];
+        if(node->isLeaf()){
+            if(node->size >= leaf_min)
+                continue;
+            int m = (left->size + node->size) / 2 - node->size;    // 从左兄弟移过来的键数
+            node->keys.insert(node->keys.begin(), left->keys.end() - m, left->keys.end());
+            node->values.insert(node->values.begin(), std::make_move_iterator(left->values.end() - m),
+                                std::make_move_iterator(left->values.end()));
+            left->keys.resize(left->size - m);
+            left->values.resize(left->size - m);
+            left->size -= m;
+            node->size += m;
+            parent->keys.back() = node->keys[0];
+        }
+        else{
+            if(node->size >= nonleaf_min)
+                continue;
+            // 左兄弟的后m个孩子移过来，它们之间的m-1个键与父节点中的分隔键一起下来，左兄弟剩下的最后一个键升上去
+            int s = left->size;
+            int m = (s + 1 + node->size + 1) / 2 - (node->size + 1);
+            node->keys.insert(node->keys.begin(), parent->keys.back());
+            node->keys.insert(node->keys.begin(), left->keys.begin() + s + 1 - m, left->keys.end());
+            node->children.insert(node->children.begin(), left->children.end() - m, left->children.end());
+            parent->keys.back() = left->keys[s - m];
+            left->keys.resize(s - m);
+            left->children.resize(s + 1 - m);
+            left->size = s - m;
+            node->size += m;
+        }
+    }
+}
+
+// 结束追加，返回新树的根（空树返回nullptr），节点的所有权交给调用者
+BPlusNode *TreeBuilder::finish()
+{
+    if(spine.empty())
+        return nullptr;
+    fix_right_edge();
+    BPlusNode *root = spine.back();
+    spine.clear();
+    return root;
+}
+
+size_t TreeBuilder::leaves() const
+{
+    return leaf_count;
+}
+
+size_t TreeBuilder::keys() const
+{
+    return key_count;
+}
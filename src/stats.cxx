@@ -0,0 +1,228 @@
+#include "stats.h"
+#include <mutex>
+#include <iomanip>
+
+const char *statOpName(StatOp op)
+{
+    static const char *names[OP_COUNT] = {"search", "insert", "modify", "delete", "scan", "delete_range", "upsert", "update", "batch"};
+    return names[op];
+}
+
+const char *statCounterName(StatCounter c)
+{
+    static const char *names[CNT_COUNT] = {"nodes_visited", "keys_compared", "splits", "borrows", "merges", "index_changes", "flushes", "batched_ops"};
+    return names[c];
+}
+
+/*******************    延迟直方图     *********************/
+// 计算值所在的桶
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+    if(value < (uint64_t)SUB_BUCKETS)
+        return (int)value;
+    int exp = 63 - __builtin_clzll(value);      // 最高位所在位置
+    int sub = (int)((value >> (exp - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (exp - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// 桶所能表示的最大值
+uint64_t LatencyHistogram::bucketValue(int index)
+{
+    if(index < SUB_BUCKETS)
+        return index;
+    int exp = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = index % SUB_BUCKETS;
+    uint64_t width = 1ULL << (exp - SUB_BUCKET_BITS);
+    return ((SUB_BUCKETS + sub) << (exp - SUB_BUCKET_BITS)) + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    counts[bucketIndex(value)]++;
+    total++;
+    sum += value;
+}
+
+void LatencyHistogram::addBucket(int index, uint64_t n, uint64_t s)
+{
+    counts[index] += n;
+    total += n;
+    sum += s;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for(int i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+}
+
+void LatencyHistogram::subtract(const LatencyHistogram &other)
+{
+    for(int i = 0; i < BUCKETS; i++)
+        counts[i] -= other.counts[i];
+    total -= other.total;
+    sum -= other.sum;
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(counts, counts + BUCKETS, 0);
+    total = 0;
+    sum = 0;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return total;
+}
+
+uint64_t LatencyHistogram::bucketCount(int index) const
+{
+    return counts[index];
+}
+
+double LatencyHistogram::mean() const
+{
+    return total ? (double)sum / total : 0.0;
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    for(int i = BUCKETS - 1; i >= 0; i--)
+        if(counts[i])
+            return bucketValue(i);
+    return 0;
+}
+
+// 百分位数：返回第一个使累计数达到 p% 的桶的值
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if(total == 0)
+        return 0;
+    uint64_t target = (uint64_t)(p / 100.0 * total + 0.5);
+    if(target < 1)
+        target = 1;
+    if(target > total)
+        target = total;
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS; i++){
+        seen += counts[i];
+        if(seen >= target)
+            return bucketValue(i);
+    }
+    return max();
+}
+
+
+/*******************    快照     *********************/
+void StatsSnapshot::print(std::ostream &os) const
+{
+    os << "Counters:" << '\n';
+    for(int c = 0; c < CNT_COUNT; c++)
+        os << "  " << std::left << std::setw(16) << statCounterName((StatCounter)c) << counters[c] << '\n';
+
+    os << "Latency (ns):" << '\n';
+    for(int op = 0; op < OP_COUNT; op++){
+        const LatencyHistogram &h = latency[op];
+        if(h.count() == 0)
+            continue;
+        os << "  " << std::left << std::setw(8) << statOpName((StatOp)op)
+           << " count=" << h.count()
+           << " mean=" << (uint64_t)h.mean()
+           << " p50=" << h.percentile(50)
+           << " p90=" << h.percentile(90)
+           << " p99=" << h.percentile(99)
+           << " p999=" << h.percentile(99.9)
+           << " max=" << h.max() << '\n';
+    }
+    os << std::right;
+}
+
+
+namespace stats{
+
+// 线程注册表：在线线程的统计数据、已退出线程累积的数据、以及上次 reset 时的基线
+struct Registry{
+    std::mutex mtx;
+    vector<ThreadStats*> threads;
+    StatsSnapshot retired;
+    StatsSnapshot baseline;
+};
+
+static Registry &registry()
+{
+    static Registry *r = new Registry();    // 不析构，保证线程退出时仍可访问
+    return *r;
+}
+
+static void accumulate(StatsSnapshot &snap, const ThreadStats &ts)
+{
+    for(int c = 0; c < CNT_COUNT; c++)
+        snap.counters[c] += ts.counters[c].load(std::memory_order_relaxed);
+    for(int op = 0; op < OP_COUNT; op++){
+        for(int i = 0; i < LatencyHistogram::BUCKETS; i++){
+            uint64_t n = ts.buckets[op][i].load(std::memory_order_relaxed);
+            if(n)
+                snap.latency[op].addBucket(i, n, 0);
+        }
+        snap.latency[op].addBucket(0, 0, ts.sum[op].load(std::memory_order_relaxed));
+    }
+}
+
+ThreadStats::ThreadStats()
+{
+    for(auto &c : counters)
+        c.store(0, std::memory_order_relaxed);
+    for(auto &per_op : buckets)
+        for(auto &b : per_op)
+            b.store(0, std::memory_order_relaxed);
+    for(auto &s : sum)
+        s.store(0, std::memory_order_relaxed);
+
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    r.threads.push_back(this);
+}
+
+// 线程退出：把数据并入 retired，避免丢失
+ThreadStats::~ThreadStats()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    accumulate(r.retired, *this);
+    r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+}
+
+// 汇总所有数据（需持有锁）
+static StatsSnapshot total_locked(Registry &r)
+{
+    StatsSnapshot snap = r.retired;
+    for(auto ts : r.threads)
+        accumulate(snap, *ts);
+    return snap;
+}
+
+StatsSnapshot snapshot()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    StatsSnapshot snap = total_locked(r);
+    for(int c = 0; c < CNT_COUNT; c++)
+        snap.counters[c] -= r.baseline.counters[c];
+    for(int op = 0; op < OP_COUNT; op++)
+        snap.latency[op].subtract(r.baseline.latency[op]);
+    return snap;
+}
+
+// 重置：不直接清零其他线程的计数器（会与其写入竞争），而是记录当前总量作为基线
+void reset()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    r.baseline = total_locked(r);
+}
+
+}
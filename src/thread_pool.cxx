@@ -0,0 +1,65 @@
+#include "thread_pool.h"
+
+// threads<=0 时按硬件线程数启动
+ThreadPool::ThreadPool(int threads)
+{
+    if(threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for(int i = 0; i < threads; i++)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for(auto &t : workers)
+        t.join();
+}
+
+int ThreadPool::size() const
+{
+    return workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        tasks.push(std::move(task));
+    }
+    task_ready.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    all_done.wait(lock, [this]{ return tasks.empty() && running == 0; });
+}
+
+// 关闭时先把队列中剩下的任务做完再退出
+void ThreadPool::worker_loop()
+{
+    while(true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            task_ready.wait(lock, [this]{ return stopping || !tasks.empty(); });
+            if(tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop();
+            running++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running--;
+            if(tasks.empty() && running == 0)
+                all_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,286 @@
+#include "tiering.h"
+#include <fcntl.h>
+#include <cstdio>
+
+/*******************    溢出文件     *********************/
+std::shared_ptr<SpillFile> SpillFile::open(const string &path)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        std::cerr << "Error: open spill file failed: " << path << endl;
+        return nullptr;
+    }
+    std::shared_ptr<SpillFile> file(new SpillFile());
+    file->path = path;
+    file->fd = fd;
+    return file;
+}
+
+SpillFile::~SpillFile()
+{
+    if(fd >= 0){
+        close(fd);
+        std::remove(path.c_str());
+    }
+}
+
+// 取一段能装下length字节的空间：优先用能装下的最小空闲段，剩下的部分仍是空闲段；没有就追加在文件末尾
+uint64_t SpillFile::allocate(uint64_t length)
+{
+    std::lock_guard<std::mutex> lock(extent_mutex);
+    auto fit = free_by_size.lower_bound(length);
+    if(fit == free_by_size.end())
+        return end.fetch_add(length);
+    uint64_t offset = fit->second, extent = fit->first;
+    erase_extent(free_by_offset.find(offset));
+    if(extent > length){
+        free_by_offset[offset + length] = extent - length;
+        free_by_size.emplace(extent - length, offset + length);
+    }
+    return offset;
+}
+
+void SpillFile::erase_extent(std::map<uint64_t, uint64_t>::iterator it)
+{
+    auto range = free_by_size.equal_range(it->second);
+    for(auto s = range.first; s != range.second; ++s)
+        if(s->second == it->first){
+            free_by_size.erase(s);
+            break;
+        }
+    free_by_offset.erase(it);
+}
+
+// 写入压缩字节，offset返回写入的位置
+bool SpillFile::write(const string &data, uint64_t &offset)
+{
+    offset = allocate(data.size());
+    size_t done = 0;
+    while(done < data.size()){
+        ssize_t n = pwrite(fd, data.data() + done, data.size() - done, offset + done);
+        if(n <= 0){
+            std::cerr << "Error: write spill file failed: " << path << endl;
+            live += data.size();
+            release(offset, data.size());
+            return false;
+        }
+        done += n;
+    }
+    live += data.size();
+    return true;
+}
+
+// 归还[offset, offset+length)：与前后的空闲段合并，合并后位于文件末尾的截掉
+void SpillFile::release(uint64_t offset, uint32_t length)
+{
+    if(length == 0)
+        return;
+    live -= length;
+    std::lock_guard<std::mutex> lock(extent_mutex);
+    uint64_t lo = offset, hi = offset + length;
+    auto next = free_by_offset.lower_bound(lo);
+    if(next != free_by_offset.end() && next->first == hi){
+        hi += next->second;
+        erase_extent(next);
+    }
+    auto prev = free_by_offset.lower_bound(lo);
+    if(prev != free_by_offset.begin()){
+        --prev;
+        if(prev->first + prev->second == lo){
+            lo = prev->first;
+            erase_extent(prev);
+        }
+    }
+    if(hi == end.load()){
+        end = lo;
+        if(ftruncate(fd, lo) != 0)
+            std::cerr << "Error: truncate spill file failed: " << path << endl;
+        return;
+    }
+    free_by_offset[lo] = hi - lo;
+    free_by_size.emplace(hi - lo, lo);
+}
+
+// pread不移动文件位置，多个线程可以同时读
+bool SpillFile::read(uint64_t offset, uint32_t length, string &data)
+{
+    data.resize(length);
+    size_t done = 0;
+    while(done < length){
+        ssize_t n = pread(fd, &data[done], length - done, offset + done);
+        if(n <= 0){
+            std::cerr << "Error: read spill file failed: " << path << endl;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+uint64_t SpillFile::size() const
+{
+    return end.load();
+}
+
+uint64_t SpillFile::liveBytes() const
+{
+    return live.load();
+}
+
+ColdLeaf::~ColdLeaf()
+{
+    if(file)
+        file->release(offset, length);
+}
+
+/*******************    value编码     *********************/
+static void put_varint(string &out, uint32_t v)
+{
+    while(v >= 0x80){
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static bool get_varint(const string &in, size_t &pos, uint32_t &v)
+{
+    v = 0;
+    for(int shift = 0; shift < 35 && pos < in.size(); shift += 7){
+        uint8_t b = in[pos++];
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// 每个value编码为：与前一个value的共同前缀长度、（去掉前缀后的）共同后缀长度、中间部分的长度与字节
+void encode_values(const vector<value_type> &values, int n, string &out)
+{
+    out.clear();
+    const value_type empty;
+    for(int i = 0; i < n; i++){
+        const value_type &prev = i > 0 ? values[i-1] : empty, &cur = values[i];
+        size_t limit = std::min(prev.size(), cur.size());
+        size_t prefix = 0;
+        for(; prefix < limit && prev[prefix] == cur[prefix]; prefix++);
+        size_t suffix = 0;
+        for(; suffix < limit - prefix && prev[prev.size()-1-suffix] == cur[cur.size()-1-suffix]; suffix++);
+        size_t middle = cur.size() - prefix - suffix;
+        put_varint(out, prefix);
+        put_varint(out, suffix);
+        put_varint(out, middle);
+        out.append(cur, prefix, middle);
+    }
+}
+
+// 解码出n个value，数据不完整时返回false
+bool decode_values(const string &data, int n, vector<value_type> &values)
+{
+    values.clear();
+    size_t pos = 0;
+    for(int i = 0; i < n; i++){
+        uint32_t prefix, suffix, middle;
+        if(!get_varint(data, pos, prefix) || !get_varint(data, pos, suffix) || !get_varint(data, pos, middle))
+            return false;
+        const value_type *prev = i > 0 ? &values[i-1] : nullptr;
+        size_t prev_size = prev ? prev->size() : 0;
+        if((size_t)prefix + suffix > prev_size || middle > data.size() - pos)
+            return false;
+        value_type v;
+        v.reserve(prefix + middle + suffix);
+        if(prev)
+            v.append(*prev, 0, prefix);
+        v.append(data, pos, middle);
+        if(prev)
+            v.append(*prev, prev_size - suffix, suffix);
+        pos += middle;
+        values.push_back(std::move(v));
+    }
+    return true;
+}
+
+/*******************    统计     *********************/
+size_t TierStats::residentBytes() const
+{
+    return inner_bytes + hot_bytes + cold_bytes;
+}
+
+void TierStats::print(std::ostream &os) const
+{
+    os << "Tiering: leaves=" << leaves << " cold=" << cold_leaves << " spilled=" << spilled_leaves
+       << " resident=" << residentBytes() << "B (inner=" << inner_bytes << " hot=" << hot_bytes
+       << " cold=" << cold_bytes << ") cold_raw_values=" << cold_raw_bytes << "B"
+       << " spill_file=" << spilled_bytes << "B (live=" << spilled_live_bytes << "B)"
+       << " freezes=" << freezes << " thaws=" << thaws << " sweeps=" << sweeps << endl;
+}
+
+/*******************    后台分层     *********************/
+Tierer::Tierer(const TieringConfig &config, const std::function<bool()> &step)
+    : config(config), step(step)
+{
+    if(!config.spill_file.empty())
+        spill = SpillFile::open(config.spill_file);
+}
+
+// 启动后台线程；树在拿到Tierer的指针之后再调用，线程中的step才能访问到它
+void Tierer::start()
+{
+    if(config.interval_ms > 0 && !worker.joinable())
+        worker = std::thread(&Tierer::run, this);
+}
+
+Tierer::~Tierer()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if(worker.joinable())
+        worker.join();
+}
+
+std::recursive_mutex &Tierer::mutex()
+{
+    return tree_mutex;
+}
+
+bool Tierer::isCold(uint32_t last_access) const
+{
+    return epoch - last_access >= (uint32_t)config.cold_epochs;
+}
+
+// 每隔interval_ms扫描一遍；一遍分成若干批，批与批之间放开锁，让树上的操作插进来
+void Tierer::run()
+{
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    while(!stopping){
+        wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms), [this]{ return stopping.load(); });
+        if(stopping)
+            break;
+        lock.unlock();
+        bool wrapped = false;
+        while(!wrapped && !stopping){
+            {
+                std::lock_guard<std::recursive_mutex> guard(tree_mutex);
+                wrapped = step();
+            }
+            std::this_thread::yield();
+        }
+        lock.lock();
+    }
+}
+
+TierGuard::TierGuard(Tierer *tierer): tierer(tierer)
+{
+    if(tierer)
+        tierer->mutex().lock();
+}
+
+TierGuard::~TierGuard()
+{
+    if(tierer)
+        tierer->mutex().unlock();
+}
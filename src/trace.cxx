@@ -0,0 +1,186 @@
+#include "trace.h"
+
+static const char TRACE_MAGIC[8] = {'B', 'P', 'T', 'T', 'R', 'A', 'C', 'E'};
+static const char TRACE_VERSION = 2;      // 2：原地修改带上修改后的value
+
+const char *traceOpName(TraceOp op)
+{
+    static const char *names[TRACE_OP_COUNT] = {"search", "insert", "modify", "delete", "scan", "delete_range", "upsert", "update"};
+    return names[op];
+}
+
+static void put_varint(string &buf, uint64_t v)
+{
+    while(v >= 0x80){
+        buf.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back((char)v);
+}
+
+// zigzag编码：使绝对值小的负数也能编码得很短
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+
+/*******************    记录     *********************/
+TraceRecorder::~TraceRecorder()
+{
+    close();
+}
+
+bool TraceRecorder::open(const string &file_name)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    out.open(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open()){
+        std::cerr << "Error: failed to open trace file: " << file_name << endl;
+        return false;
+    }
+    out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    out.put(TRACE_VERSION);
+    buffer.clear();
+    start = std::chrono::steady_clock::now();
+    last_ns = 0;
+    return true;
+}
+
+void TraceRecorder::close()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!out.is_open())
+        return;
+    flush();
+    out.close();
+}
+
+void TraceRecorder::flush()
+{
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+// 写入记录的公共部分：操作类型、时间差、键（需持有锁）
+void TraceRecorder::put_header(TraceOp op, const key_type &key)
+{
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if(now < last_ns)
+        now = last_ns;
+
+    buffer.push_back((char)op);
+    put_varint(buffer, now - last_ns);
+    put_varint(buffer, zigzag(key));
+    last_ns = now;
+}
+
+void TraceRecorder::record(TraceOp op, const key_type &key, const value_type *value, uint64_t count)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!out.is_open())
+        return;
+
+    put_header(op, key);
+    if(op == TRACE_INSERT || op == TRACE_MODIFY || op == TRACE_UPSERT || op == TRACE_UPDATE){
+        put_varint(buffer, value->size());
+        buffer.append(*value);
+    }
+    else if(op == TRACE_SCAN)
+        put_varint(buffer, count);
+
+    if(buffer.size() >= FLUSH_SIZE)
+        flush();
+}
+
+void TraceRecorder::recordRange(TraceOp op, const key_type &lo, const key_type &hi)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!out.is_open())
+        return;
+
+    put_header(op, lo);
+    put_varint(buffer, zigzag(hi));
+
+    if(buffer.size() >= FLUSH_SIZE)
+        flush();
+}
+
+
+/*******************    读取     *********************/
+bool TraceReader::open(const string &file_name)
+{
+    in.open(file_name, std::ios::in | std::ios::binary);
+    if(!in.is_open()){
+        std::cerr << "Error: failed to open trace file: " << file_name << endl;
+        return false;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if(!in || !std::equal(magic, magic + sizeof(magic), TRACE_MAGIC) || in.get() != TRACE_VERSION){
+        std::cerr << "Error: not a trace file (or unsupported version): " << file_name << endl;
+        in.close();
+        return false;
+    }
+    time_ns = 0;
+    return true;
+}
+
+bool TraceReader::read_varint(uint64_t &v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        int c = in.get();
+        if(c == EOF)
+            return false;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool TraceReader::next(TraceRecord &rec)
+{
+    int op = in.get();
+    if(op == EOF || op >= TRACE_OP_COUNT)
+        return false;
+
+    uint64_t delta, key;
+    if(!read_varint(delta) || !read_varint(key))
+        return false;
+    time_ns += delta;
+    rec.op = (TraceOp)op;
+    rec.time_ns = time_ns;
+    rec.key = (key_type)unzigzag(key);
+    rec.value.clear();
+    rec.count = 0;
+    rec.end_key = rec.key;
+
+    if(rec.op == TRACE_INSERT || rec.op == TRACE_MODIFY || rec.op == TRACE_UPSERT || rec.op == TRACE_UPDATE){
+        uint64_t len;
+        if(!read_varint(len))
+            return false;
+        rec.value.resize(len);
+        in.read(&rec.value[0], len);
+        if(!in)
+            return false;
+    }
+    else if(rec.op == TRACE_SCAN){
+        if(!read_varint(rec.count))
+            return false;
+    }
+    else if(rec.op == TRACE_DELETE_RANGE){
+        uint64_t end_key;
+        if(!read_varint(end_key))
+            return false;
+        rec.end_key = (key_type)unzigzag(end_key);
+    }
+    return true;
+}
@@ -1,4 +1,16 @@
 #include "tree.h"
+#include <limits>
+#include <fcntl.h>
+#include <sstream>
+
+// 写优化模式下一组缓冲分区中的消息总数
+static int partition_total(const vector<vector<Message>> &parts)
+{
+    int total = 0;
+    for(auto &part : parts)
+        total += part.size();
+    return total;
+}
 
 BPlusTree::BPlusTree(int degree)
 {
@@ -8,7 +20,14 @@ BPlusTree::BPlusTree(int degree)
 
 BPlusTree::~BPlusTree()
 {
+    delete tierer;      // 先停掉后台线程
+    tierer = nullptr;
+    if(reclaimer.joinable())
+        reclaimer.join();
+    delete restructure;
     clear_tree();
+    delete hot_cache;
+    delete learned_index;
 }
 
 int BPlusTree::getDegree()
@@ -16,56 +35,99 @@ int BPlusTree::getDegree()
     return leaf_max_degree;
 }
 
+int BPlusTree::getNonleafDegree()
+{
+    return nonleaf_max_degree;
+}
+
 
 // 获取根结点
 BPlusNode *BPlusTree::getRoot(){ 
     return root; 
 }
 
-// 修改B+树度数
+// 修改B+树度数：叶子与内部节点取相同的度数
 bool BPlusTree::set_degree(int degree)
 {
-    if(!root){
-        leaf_max_degree = degree;
-        leaf_min_degree = (leaf_max_degree+1)/2;
-        nonleaf_max_degree = leaf_max_degree;
-        nonleaf_min_degree = (nonleaf_max_degree+1)/2;  
-        cout << "Successfully changed degree into: " << degree <<  endl;
-        return true;     
+    return set_degrees(degree, degree);
+}
+
+// 分别设置叶子与内部节点的度数；树不为空时在线重建成新的度数
+bool BPlusTree::set_degrees(int leaf_degree, int nonleaf_degree)
+{
+    if(leaf_degree < 3 || nonleaf_degree < 3){
+        cout << "Failed to change degree: degree must be at least 3!" << endl;
+        return false;
+    }
+    if(root){
+        begin_restructure(leaf_degree, nonleaf_degree);
+        while(!restructure_step(1024));
+        if(!finish_restructure())
+            return false;
+        cout << "Successfully restructured the tree into degree: " << leaf_degree;
     }
     else{
-        cout << "Failed to change degree: The tree is not empty!" << endl;
-        return false;
+        abort_restructure();
+        apply_degrees(leaf_degree, nonleaf_degree);
+        cout << "Successfully changed degree into: " << leaf_degree;
     }
-
+    if(nonleaf_degree != leaf_degree)
+        cout << " (leaves), " << nonleaf_degree << " (inner nodes)";
+    cout << endl;
+    return true;
 }
 
 /*******************    查找     *********************/
 // 搜索key，并通过引用传递返回对应的value值，函数返回值表示是否成功查找到
 bool BPlusTree::searchKeyValue(const key_type &key, value_type &value){
+    BPT_STAT_TIMER(OP_SEARCH);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_SEARCH, key);
     if(this->getRoot() == nullptr){
         std::cerr << "Error: search failed: tree is empty!" << endl;
         return false;
     }
+    if(hot_cache && hot_cache->lookup(key, value))
+        return true;
+    if(write_optimized){
+        if(buffered_search(key, value)){
+            if(hot_cache)
+                hot_cache->admit(key, value);
+            return true;
+        }
+        std::cerr << "Error: search failed: key '" << key << "' desn't exist!" << endl;
+        return false;
+    }
 
-    // 确定key所在的节点
-    BPlusNode *p = root;
-    while(!p->isLeaf()){
-        int i = 0;
-        for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
-        p = p->getChild(i);
+    // 确定key所在的节点：开启学习索引时由模型预测，模型不可用时从根下降
+    BPlusNode *p = learned_index ? learned_leaf(key) : nullptr;
+    if(!p){
+        p = root;
+        while(!p->isLeaf()){
+            int i = 0;
+            for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+            BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+            BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+            p = p->getChild(i);
+        }
     }
 
     // 确定key在节点中的索引
     int j = 0;
     for(; j < p->getSize() && p->getKey(j) != key; j++);
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+    BPT_STAT_ADD(CNT_KEYS_COMPARED, j < p->getSize() ? j+1 : j);
 
     // 确定对应的value值
     if(j == p->getSize()){
         std::cerr << "Error: search failed: key '" << key << "' desn't exist!" << endl;
         return false;
     }
+    touch_leaf(p);
     value = p->getValue(j);
+    if(hot_cache)
+        hot_cache->admit(key, value);
     return true;
 }
 
@@ -79,46 +141,75 @@ int BPlusTree::find_key_index(BPlusNode *node, const key_type &key){
 /*******************    插入     *********************/
 // 插入数据到叶节点
 void BPlusTree::insert_into_leaf(BPlusNode *leaf, const key_type &key, const value_type &value){
+    touch_leaf(leaf);
     int index = find_key_index(leaf, key);
     leaf->keys.insert(leaf->keys.begin()+index, key);
     leaf->values.insert(leaf->values.begin()+index, value);
     leaf->size++;
 }
 
-// 插入数据到内部节点
-void BPlusTree::insert_into_nonleaf(BPlusNode *node, const key_type &key, BPlusNode *child){
+// 插入数据到内部节点，index为刚分裂的孩子的位置（来自搜索路径），新孩子放在其右边
+void BPlusTree::insert_into_nonleaf(BPlusNode *node, int index, const key_type &key, BPlusNode *child){
     if(node == nullptr){    // 父内部节点为空，即刚才分裂的是根节点
         BPlusNode* new_root = new BPlusNode(false, 1);
+        reserve_node(new_root);
         new_root->keys.push_back(key);
         new_root->children.push_back(root);
         new_root->children.push_back(child);
+        if(order_stats){
+            new_root->counts.push_back(subtree_count(root));
+            new_root->counts.push_back(subtree_count(child));
+        }
         root = new_root;
     }
     else{
-        int index = find_key_index(node, key);
         node->keys.insert(node->keys.begin()+index, key);
         node->children.insert(node->children.begin()+index+1, child);
         node->size++;            
+        if(order_stats){    // 刚分裂的孩子在index处，新孩子在index+1处
+            node->counts[index] = subtree_count(node->children[index]);
+            node->counts.insert(node->counts.begin()+index+1, subtree_count(child));
+        }
     }
 
 }
 
+// 按度数为节点预留容量，之后插入/借/合并都不会再触发vector扩容
+void BPlusTree::reserve_node(BPlusNode *node){
+    if(node->isLeaf()){
+        node->keys.reserve(leaf_max_degree);
+        node->values.reserve(leaf_max_degree);
+    }
+    else{
+        node->keys.reserve(nonleaf_max_degree);
+        node->children.reserve(nonleaf_max_degree+1);
+        if(order_stats)
+            node->counts.reserve(nonleaf_max_degree+1);
+    }
+}
+
 // 分裂叶节点，返回值为新叶子中最小key值
 key_type BPlusTree::split_leaf(BPlusNode *leaf){
     // 确定分裂点，数值上等于旧节点中保留的key数目
     int split_point = leaf_max_degree/2;    
 
-    // 创建新叶子
-    vector<key_type> tail_keys(leaf->keys.begin()+split_point, leaf->keys.end());
-    vector<value_type> tail_values(leaf->values.begin()+split_point, leaf->values.end());
-    BPlusNode *new_leaf = new BPlusNode(true, leaf_max_degree - split_point, tail_keys, tail_values);
+    // 创建新叶子：预留好容量后直接从旧叶子尾部搬入，不经过临时vector，value用移动代替复制
+    BPlusNode *new_leaf = new BPlusNode(true, leaf_max_degree - split_point);
+    reserve_node(new_leaf);
+    new_leaf->keys.assign(leaf->keys.begin()+split_point, leaf->keys.end());
+    new_leaf->values.assign(std::make_move_iterator(leaf->values.begin()+split_point),
+                            std::make_move_iterator(leaf->values.end()));
     // 链上新叶子
     new_leaf->next_leaf = leaf->next_leaf;
+    new_leaf->last_access = leaf->last_access;
     leaf->next_leaf = new_leaf;
     // 更新旧叶子
     leaf->keys.resize(split_point);
     leaf->values.resize(split_point);
     leaf->size = split_point;
+    // 缓存的是value副本，条目搬动本身无需处理；只有重复键跨过新的边界时，查找找到的那一条会变，作废边界键
+    if(hot_cache)
+        hot_cache->invalidate(new_leaf->keys[0]);
 
     return new_leaf->keys[0];
 }
@@ -129,9 +220,14 @@ key_type BPlusTree::split_nonleaf(BPlusNode *node, BPlusNode *&new_nonleaf){
     key_type split_key = node->keys[split_point];
 
     // 创建新节点
-    vector<key_type> tail_keys(node->keys.begin()+split_point+1, node->keys.end());
-    vector<BPlusNode*> tail_children(node->children.begin()+split_point+1, node->children.end());
-    BPlusNode *new_node = new BPlusNode(false, leaf_max_degree-split_point-1, tail_keys, tail_children);
+    BPlusNode *new_node = new BPlusNode(false, nonleaf_max_degree-split_point-1);
+    reserve_node(new_node);
+    new_node->keys.assign(node->keys.begin()+split_point+1, node->keys.end());
+    new_node->children.assign(node->children.begin()+split_point+1, node->children.end());
+    if(order_stats){
+        new_node->counts.assign(node->counts.begin()+split_point+1, node->counts.end());
+        node->counts.resize(split_point+1);
+    }
     // 更新旧节点
     node->keys.resize(split_point);
     node->children.resize(split_point+1);
@@ -143,132 +239,537 @@ key_type BPlusTree::split_nonleaf(BPlusNode *node, BPlusNode *&new_nonleaf){
 
 // 插入键值对
 bool BPlusTree::insertKeyValue(const key_type &key, const value_type &value){
+    BPT_STAT_TIMER(OP_INSERT);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_INSERT, key, &value);
+    note_write(key, key);
+    // 写优化模式：作为插入消息缓冲起来，已存在的键会被覆盖
+    if(write_optimized){
+        put_message(Message{key, MSG_PUT, value});
+        return true;
+    }
     // 树为空：创建节点作为根节点
     if(getRoot() == nullptr){
         root = new BPlusNode(true, 1);
+        reserve_node(root);
         root->keys.push_back(key);
         root->values.push_back(value);
         return true;
     }
 
     // 树非空
-    vector<BPlusNode*> path;
+    TreePath path;
     BPlusNode *p = root;
 
     // 找到该插入的叶节点
     while(!p->isLeaf()){
-        path.push_back(p);  // 把内部节点加入搜索路径
         int i = 0;
         for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+        path.push(p, i);    // 把内部节点及走向的孩子位置加入搜索路径
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+        if(order_stats)
+            p->counts[i]++;
         p = p->getChild(i);
     }
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
 
-    // 插入键值对到叶节点
+    // 插入键值对到叶节点：key若已存在，新插入的这条排在前面，之后查找会找到它，缓存中的旧值作废
     insert_into_leaf(p, key, value);
+    if(hot_cache)
+        hot_cache->invalidate(key);
     // 节点溢出，需要分裂
-    if(p->size == leaf_max_degree){
-        BPlusNode *current_node = p, *new_node;
-        BPlusNode *parent = nullptr;
-        key_type split_key;
-
-        // 分裂叶节点
-        split_key = split_leaf(current_node);
-        new_node = current_node->next_leaf;
-        if(path.empty()) {  // 叶节点是根节点
-            insert_into_nonleaf(nullptr, split_key, current_node->next_leaf);
-            return true;
-        }
-        else{   // 叶节点不是根节点
-            parent = path.back();
-            path.pop_back();
-            insert_into_nonleaf(parent, split_key, current_node->next_leaf);
+    split_upward(p, path);
+
+    return true;
+}
+
+// 叶节点插入后若溢出，分裂叶节点并沿路径往上分裂内部节点
+void BPlusTree::split_upward(BPlusNode *leaf, TreePath &path){
+    if(leaf->size < leaf_max_degree)
+        return;
+
+    BPlusNode *current_node = leaf, *new_node;
+    BPlusNode *parent = nullptr;
+    key_type split_key;
+
+    // 分裂叶节点
+    split_key = split_leaf(current_node);
+    BPT_STAT_ADD(CNT_SPLITS, 1);
+    new_node = current_node->next_leaf;
+    if(path.empty()) {  // 叶节点是根节点
+        insert_into_nonleaf(nullptr, 0, split_key, current_node->next_leaf);
+        return;
+    }
+    else{   // 叶节点不是根节点
+        parent = path.node();
+        insert_into_nonleaf(parent, path.slot(), split_key, current_node->next_leaf);
+        path.pop();
+        current_node = parent;
+    }
+
+    // 往上分裂内部节点
+    while(current_node->size == nonleaf_max_degree){
+        split_key = split_nonleaf(current_node, new_node);
+        BPT_STAT_ADD(CNT_SPLITS, 1);
+        if(path.empty()) { // 路径为空，已经向上分裂到根结点
+            insert_into_nonleaf(nullptr, 0, split_key, new_node);
+            break;
+        }     
+        else{
+            parent = path.node();
+            insert_into_nonleaf(parent, path.slot(), split_key, new_node);
+            path.pop();
             current_node = parent;
         }
+    }
+}
 
-        // 往上分裂内部节点
-        while(current_node->size == nonleaf_max_degree){
-            split_key = split_nonleaf(current_node, new_node);
-            if(path.empty()) { // 路径为空，已经向上分裂到根结点
-                insert_into_nonleaf(nullptr, split_key, new_node);
-                break;
-            }     
-            else{
-                parent = path.back();
-                path.pop_back();
-                insert_into_nonleaf(parent, split_key, new_node);
-                current_node = parent;
-            }
-        }            
+/*******************    插入或更新     *********************/
+// 插入或覆盖：只下降一次，key已存在则原地覆盖value，否则插入；返回是否插入了新键
+bool BPlusTree::upsert(const key_type &key, const value_type &value){
+    BPT_STAT_TIMER(OP_UPSERT);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_UPSERT, key, &value);
+    note_write(key, key);
+    if(write_optimized){    // 不下降到叶子，无从知道键是否已存在，总是返回true
+        put_message(Message{key, MSG_PUT, value});
+        return true;
+    }
+    return upsert_leaf(key, value, nullptr);
+}
+
+// 设置合并算子，供merge使用
+void BPlusTree::set_merge_operator(const MergeOperator &op){
+    merge_operator = op;
+}
+
+// 合并：key已存在则用合并算子把operand原地合并进旧value，否则以operand作为value插入；返回是否插入了新键
+bool BPlusTree::merge(const key_type &key, const value_type &operand){
+    BPT_STAT_TIMER(OP_UPDATE);
+    TierGuard tier_guard(tierer);
+    if(!merge_operator){
+        std::cerr << "Error: merge failed: no merge operator is set!" << endl;
+        return false;
+    }
+    note_write(key, key);
+    // 轨迹中记下合并后的value，重放时作为插入或覆盖，不依赖合并算子
+    if(write_optimized){    // 先经过缓冲读出当前值，合并结果作为插入消息写回
+        value_type value;
+        bool exists = root && buffered_search(key, value);
+        if(exists)
+            merge_operator(value, operand);
+        if(recorder)
+            recorder->record(TRACE_UPSERT, key, exists ? &value : &operand);
+        put_message(Message{key, MSG_PUT, exists ? value : operand});
+        return !exists;
+    }
+    value_type merged;
+    bool inserted = upsert_leaf(key, operand, &merge_operator, recorder ? &merged : nullptr);
+    if(recorder)
+        recorder->record(TRACE_UPSERT, key, &merged);
+    return inserted;
+}
+
+// upsert与merge的公共部分：merge_op为空时直接覆盖；result非空时带回写入后的value
+bool BPlusTree::upsert_leaf(const key_type &key, const value_type &value, const MergeOperator *merge_op, value_type *result){
+    if(getRoot() == nullptr){
+        root = new BPlusNode(true, 1);
+        reserve_node(root);
+        root->keys.push_back(key);
+        root->values.push_back(value);
+        if(result)
+            *result = value;
+        return true;
+    }
+
+    // 记录路径：只有确定要插入时才更新子树计数
+    TreePath path;
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+        path.push(p, i);
+        p = p->getChild(i);
+    }
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+
+    // key已存在：原地更新
+    touch_leaf(p);
+    int j = find_key_index(p, key);
+    if(j < p->getSize() && BPlusNode::cmpKeys(p->keys[j], key) == 0){
+        if(merge_op)
+            (*merge_op)(p->values[j], value);
+        else
+            p->values[j] = value;
+        if(hot_cache)
+            hot_cache->update(key, p->values[j]);
+        if(result)
+            *result = p->values[j];
+        return false;
     }
 
+    // key不存在：插入到j处
+    if(order_stats)
+        for(int d = 0; d < path.depth; d++)
+            path.nodes[d]->counts[path.slots[d]]++;
+    p->keys.insert(p->keys.begin()+j, key);
+    p->values.insert(p->values.begin()+j, value);
+    p->size++;
+    if(result)
+        *result = value;
+    split_upward(p, path);
     return true;
 }
 
-/*******************    修改     *********************/
-bool BPlusTree::modifyKeyValue(const key_type &key, const value_type &value){
+// 原地修改：只下降一次，把key对应的value交给fn直接修改，不复制value
+bool BPlusTree::update(const key_type &key, const std::function<void(value_type &)> &fn){
+    BPT_STAT_TIMER(OP_UPDATE);
+    TierGuard tier_guard(tierer);
+    // 修改函数无法记录：轨迹中记下修改后的value，失败的修改记空value，重放时同样失败
+    static const value_type no_value;
+    note_write(key, key);
     if(this->getRoot() == nullptr){
-        std::cerr << "Error: search failed: tree is empty!" << endl;
+        if(recorder)
+            recorder->record(TRACE_UPDATE, key, &no_value);
+        std::cerr << "Error: update failed: tree is empty!" << endl;
         return false;
     }
+    if(write_optimized){    // 值可能还在缓冲中：读出来修改后作为插入消息写回
+        value_type value;
+        if(!buffered_search(key, value)){
+            if(recorder)
+                recorder->record(TRACE_UPDATE, key, &no_value);
+            std::cerr << "Error: update failed: key '" << key << "' desn't exist!" << endl;
+            return false;
+        }
+        fn(value);
+        if(recorder)
+            recorder->record(TRACE_UPDATE, key, &value);
+        put_message(Message{key, MSG_PUT, std::move(value)});
+        return true;
+    }
 
-    // 确定key所在的节点
     BPlusNode *p = root;
     while(!p->isLeaf()){
         int i = 0;
         for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
         p = p->getChild(i);
     }
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+
+    int j = find_key_index(p, key);
+    if(j == p->getSize() || BPlusNode::cmpKeys(p->keys[j], key) != 0){
+        if(recorder)
+            recorder->record(TRACE_UPDATE, key, &no_value);
+        std::cerr << "Error: update failed: key '" << key << "' desn't exist!" << endl;
+        return false;
+    }
+    touch_leaf(p);
+    fn(p->values[j]);
+    if(recorder)
+        recorder->record(TRACE_UPDATE, key, &p->values[j]);
+    if(hot_cache)
+        hot_cache->update(key, p->values[j]);
+    return true;
+}
+
+/*******************    修改     *********************/
+bool BPlusTree::modifyKeyValue(const key_type &key, const value_type &value){
+    BPT_STAT_TIMER(OP_MODIFY);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_MODIFY, key, &value);
+    note_write(key, key);
+    if(this->getRoot() == nullptr){
+        std::cerr << "Error: search failed: tree is empty!" << endl;
+        return false;
+    }
+    if(write_optimized){    // 修改消息到达叶子时键若已不存在则被忽略，这里总是返回true
+        put_message(Message{key, MSG_UPDATE, value});
+        return true;
+    }
+
+    // 确定key所在的节点：开启学习索引时由模型预测，模型不可用时从根下降
+    BPlusNode *p = learned_index ? learned_leaf(key) : nullptr;
+    if(!p){
+        p = root;
+        while(!p->isLeaf()){
+            int i = 0;
+            for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+            BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+            BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+            p = p->getChild(i);
+        }
+    }
 
     // 确定key在节点中的索引
     int j = 0;
     for(; j < p->getSize() && p->getKey(j) != key; j++);
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+    BPT_STAT_ADD(CNT_KEYS_COMPARED, j < p->getSize() ? j+1 : j);
 
     if(j == p->getSize()){
         std::cerr << "Error: search failed: key '" << key << "' desn't exist!" << endl;
         return false;
     }
+    touch_leaf(p);
     p->setValue(j, value);
+    if(hot_cache)
+        hot_cache->update(key, value);
     return true;
 }
 
 
+/*******************    范围查询     *********************/
+// 从第一个不小于start_key的键开始，沿叶子链表顺序读取至多count个键值对，返回实际读取的数目
+int BPlusTree::scanKeyValue(const key_type &start_key, int count, vector<std::pair<key_type, value_type>> &result){
+    BPT_STAT_TIMER(OP_SCAN);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_SCAN, start_key, nullptr, count);
+    if(write_optimized)
+        flush_all();
+    result.clear();
+    if(this->getRoot() == nullptr || count <= 0)
+        return 0;
+
+    // 确定起始叶节点
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(start_key, p->getKey(i)) >= 0; i++);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+        p = p->getChild(i);
+    }
+
+    // 沿叶子链表读取：冷叶子解出一份副本，不解压回叶子，也不算作访问，一次大范围扫描不会让整棵树变热
+    int j = find_key_index(p, start_key);
+    vector<value_type> cold_values;
+    while(p && (int)result.size() < count){
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        if(j < p->getSize() && p->cold && !read_cold_values(p, cold_values))
+            cold_values.assign(p->size, value_type());
+        const vector<value_type> &values = p->cold ? cold_values : p->values;
+        for(; j < p->getSize() && (int)result.size() < count; j++)
+            result.emplace_back(p->keys[j], values[j]);
+        p = p->next_leaf;
+        j = 0;
+    }
+    return result.size();
+}
+
+
+/*******************    块扫描与并行聚合     *********************/
+// 按叶子把[lo, hi]内的键值交给visit，每次一段连续数组；visit返回false时停止，返回交出的段数
+int BPlusTree::scanBlocks(const key_type &lo, const key_type &hi, const std::function<bool(const LeafSpan &)> &visit)
+{
+    BPT_STAT_TIMER(OP_SCAN);
+    TierGuard tier_guard(tierer);
+    if(write_optimized)
+        flush_all();
+    if(root == nullptr || BPlusNode::cmpKeys(lo, hi) > 0)
+        return 0;
+    return scan_leaves(leaf_for(root, lo), lo, hi, visit);
+}
+
+// 把[lo, hi]内满足谓词的键按序写入result，返回个数
+int BPlusTree::filterRange(const key_type &lo, const key_type &hi, const KeyPredicate &pred, vector<key_type> &result)
+{
+    result.clear();
+    vector<int> selection;
+    scanBlocks(lo, hi, [&](const LeafSpan &span){
+        if((int)selection.size() < span.size)
+            selection.resize(span.size);
+        int n = filter_keys(span.keys, span.size, pred, selection.data());
+        for(int i = 0; i < n; i++)
+            result.push_back(span.keys[selection[i]]);
+        return true;
+    });
+    return result.size();
+}
+
+// 单线程聚合[lo, hi]内满足谓词的键，pred为空时聚合全部
+RangeAggregate BPlusTree::aggregateRange(const key_type &lo, const key_type &hi, const KeyPredicate *pred)
+{
+    RangeAggregate agg;
+    scanBlocks(lo, hi, [&](const LeafSpan &span){
+        aggregate_keys(span.keys, span.size, pred, agg);
+        return true;
+    });
+    return agg;
+}
+
+// 多线程聚合：按内部节点把区间切成若干子树，逐层展开直到任务数不少于线程数的4倍或到达叶子，
+// 每个任务从自己的子树下降到起始叶子，沿叶子链表扫到子树的上界为止，各任务的区间互不相交
+// 聚合期间调用者不能修改这棵树
+RangeAggregate BPlusTree::parallelAggregate(const key_type &lo, const key_type &hi, ThreadPool &pool, const KeyPredicate *pred)
+{
+    BPT_STAT_TIMER(OP_SCAN);
+    TierGuard tier_guard(tierer);   // 由调用线程持有，工作线程只解压各自区间内的叶子
+    if(write_optimized)
+        flush_all();
+    RangeAggregate total;
+    if(root == nullptr || BPlusNode::cmpKeys(lo, hi) > 0)
+        return total;
+
+    struct ScanTask{
+        BPlusNode *node;
+        key_type lo;
+        key_type hi;
+    };
+    vector<ScanTask> tasks = {{root, lo, hi}};
+    size_t target = pool.size() * 4;
+    bool expanded = true;
+    while(expanded && tasks.size() < target){
+        expanded = false;
+        vector<ScanTask> next;
+        for(auto &t : tasks){
+            BPlusNode *p = t.node;
+            if(p->isLeaf()){
+                next.push_back(t);
+                continue;
+            }
+            expanded = true;
+            // 第i个孩子覆盖[keys[i-1], keys[i])，与任务区间求交
+            for(int i = 0; i <= p->size; i++){
+                key_type clo = t.lo, chi = t.hi;
+                if(i > 0 && BPlusNode::cmpKeys(p->keys[i-1], clo) > 0)
+                    clo = p->keys[i-1];
+                if(i < p->size){
+                    if(BPlusNode::cmpKeys(p->keys[i], clo) <= 0)
+                        continue;
+                    chi = std::min(chi, p->keys[i] - 1);
+                }
+                if(BPlusNode::cmpKeys(clo, chi) <= 0)
+                    next.push_back({p->children[i], clo, chi});
+            }
+        }
+        tasks.swap(next);
+    }
+
+    // 每个任务先在局部变量中累加，最后写一次结果，避免相邻结果之间的伪共享
+    vector<RangeAggregate> parts(tasks.size());
+    for(size_t i = 0; i < tasks.size(); i++){
+        pool.submit([this, &tasks, &parts, pred, i]{
+            const ScanTask &t = tasks[i];
+            RangeAggregate agg;
+            scan_leaves(leaf_for(t.node, t.lo), t.lo, t.hi, [&](const LeafSpan &span){
+                aggregate_keys(span.keys, span.size, pred, agg);
+                return true;
+            });
+            parts[i] = agg;
+        });
+    }
+    pool.wait();
+    for(auto &part : parts)
+        total.merge(part);
+    return total;
+}
+
+// 从node往下找到key所在的叶子
+BPlusNode *BPlusTree::leaf_for(BPlusNode *node, const key_type &key)
+{
+    while(!node->isLeaf()){
+        int i = 0;
+        for(; i < node->size && BPlusNode::cmpKeys(key, node->keys[i]) >= 0; i++);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        node = node->children[i];
+    }
+    return node;
+}
+
+// 从leaf开始沿叶子链表交出[lo, hi]内的段，遇到超过hi的键即停
+int BPlusTree::scan_leaves(BPlusNode *leaf, const key_type &lo, const key_type &hi, const std::function<bool(const LeafSpan &)> &visit)
+{
+    int spans = 0;
+    int j = find_key_index(leaf, lo);
+    vector<value_type> cold_values;     // 同范围查询：冷叶子只解出副本，不改动叶子，并行聚合的各线程互不影响
+    for(BPlusNode *p = leaf; p; p = p->next_leaf, j = 0){
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        int end = std::upper_bound(p->keys.begin() + j, p->keys.begin() + p->size, hi) - p->keys.begin();
+        if(end > j){
+            if(p->cold && !read_cold_values(p, cold_values))
+                cold_values.assign(p->size, value_type());
+            const value_type *values = p->cold ? cold_values.data() : p->values.data();
+            spans++;
+            if(!visit(LeafSpan{p->keys.data() + j, values + j, end - j}))
+                break;
+        }
+        if(end < p->size)
+            break;
+    }
+    return spans;
+}
 
 /*******************    删除     *********************/
 // 删除键值对
 bool BPlusTree::deleteKeyValue(const key_type &key) {
+    BPT_STAT_TIMER(OP_DELETE);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->record(TRACE_DELETE, key);
+    note_write(key, key);
     if (getRoot() == nullptr) {
         std::cerr << "Error: delete failed: tree is empty!" << endl;
         return false;
     }
+    if(write_optimized){    // 同修改：键不存在的删除消息到达叶子时被忽略
+        put_message(Message{key, MSG_DELETE, value_type()});
+        return true;
+    }
 
     // 查找要删除键所在的叶节点
     BPlusNode *current_node = root;
-    vector<BPlusNode*> path;    // 记录查找路径，便于之后查找父节点
+    TreePath path;      // 记录查找路径及每层的孩子位置，便于之后查找父节点和兄弟
     while (!current_node->isLeaf()) {
         int i = 0;
         for (; i < current_node->getSize() && BPlusNode::cmpKeys(key, current_node->getKey(i)) >= 0; i++);
-        path.push_back(current_node);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < current_node->getSize() ? i+1 : i);
+        path.push(current_node, i);
         current_node = current_node->getChild(i);
     }
 
     // 在叶节点中查找要删除的键的位置
     int index = 0;
     for (; index < current_node->getSize() && current_node->getKey(index) != key; index++);
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+    BPT_STAT_ADD(CNT_KEYS_COMPARED, index < current_node->getSize() ? index+1 : index);
 
     if (index == current_node->getSize()) {
         std::cerr << "Error: delete failed: key '" << key << "' doesn't exist!" << endl;
         return false;
     }
 
+    if(hot_cache)
+        hot_cache->invalidate(key);
+
+    // 路径上的子树键数减一
+    if(order_stats)
+        for(int d = 0; d < path.depth; d++)
+            path.nodes[d]->counts[path.slots[d]]--;
+
     // 从叶节点中删除键值对
+    touch_leaf(current_node);
     current_node->keys.erase(current_node->keys.begin() + index);
     current_node->values.erase(current_node->values.begin() + index);
     current_node->size--;
 
     // 要判断叶节点是否是根节点且被删空了
     if(current_node == getRoot()){
-        if(current_node->getSize() == 0)
+        if(current_node->getSize() == 0){
             root = nullptr;
+            if(learned_index)
+                learned_index->invalidate();
+        }
     }
     // 不是根结点，判断是否是最小key，需要改索引，先改索引再判断是否需要调整
     else{
@@ -287,14 +788,15 @@ bool BPlusTree::deleteKeyValue(const key_type &key) {
 }
 
 // 调整叶节点
-void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
-    BPlusNode *parent = path.back();
-    int index = child_index(parent, node);
+void BPlusTree::adjustLeafNode(BPlusNode *node, TreePath &path) {
+    BPlusNode *parent = path.node();
+    int index = path.slot();    // 下降时已记录node在parent中的位置
 
     /********* 首先尝试：借 ********/
     // 尝试从左兄弟节点中借一个键值对
     if (index > 0 && parent->getChild(index - 1)->getSize() > leaf_min_degree-1) {
         BPlusNode *left_sibling = parent->getChild(index - 1);
+        touch_leaf(left_sibling);
         node->keys.insert(node->keys.begin(), left_sibling->getKey(left_sibling->getSize() - 1));
         node->values.insert(node->values.begin(), left_sibling->getValue(left_sibling->getSize() - 1));
         node->size++;  
@@ -302,10 +804,20 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
         left_sibling->values.pop_back();
         left_sibling->size--;
         parent->keys[index - 1] = node->getKey(0);  // 更新索引
+        if(hot_cache)   // 边界移动：作废跨过边界的键
+            hot_cache->invalidate(node->getKey(0));
+        if(order_stats){
+            parent->counts[index - 1]--;
+            parent->counts[index]++;
+        }
+        BPT_STAT_ADD(CNT_BORROWS, 1);
     }
     // 尝试从右兄弟节点中借一个键值对
     else if (index < parent->getSize() && parent->getChild(index + 1)->getSize() > leaf_min_degree-1) {
         BPlusNode *right_sibling = parent->getChild(index + 1);
+        touch_leaf(right_sibling);
+        if(hot_cache)
+            hot_cache->invalidate(right_sibling->getKey(0));
         node->keys.push_back(right_sibling->getKey(0));
         node->values.push_back(right_sibling->getValue(0));
         node->size++;   
@@ -313,6 +825,11 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
         right_sibling->values.erase(right_sibling->values.begin());
         right_sibling->size--;
         parent->keys[index] = right_sibling->getKey(0); // 更新右兄弟索引
+        if(order_stats){
+            parent->counts[index + 1]--;
+            parent->counts[index]++;
+        }
+        BPT_STAT_ADD(CNT_BORROWS, 1);
         // 若借之前，节点为空，则还需更新当前节点的索引
         if(node->size == 1){
             change_index(node, path);
@@ -322,9 +839,15 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
 
     /********* 不能借则尝试：合并 ********/
     else {
+        BPT_STAT_ADD(CNT_MERGES, 1);
+        if(learned_index)   // 有叶子被释放，学习索引的叶子目录作废
+            learned_index->invalidate();
         // 尝试合并到左兄弟
         if (index > 0) {  
             BPlusNode *left_sibling = parent->getChild(index - 1);
+            touch_leaf(left_sibling);
+            if(hot_cache && node->size > 0)     // 两个叶子的边界消失
+                hot_cache->invalidate(node->getKey(0));
             left_sibling->keys.insert(left_sibling->keys.end(), node->keys.begin(), node->keys.end());
             left_sibling->values.insert(left_sibling->values.end(), node->values.begin(), node->values.end());
             left_sibling->size += node->size;
@@ -332,8 +855,13 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
             parent->keys.erase(parent->keys.begin() + index - 1);
             parent->children.erase(parent->children.begin() + index);
             parent->size--;
+            if(order_stats){
+                parent->counts[index - 1] += parent->counts[index];
+                parent->counts.erase(parent->counts.begin() + index);
+            }
 
             delete node;   // 释放内存
+            node = left_sibling;    // 父节点若是根且被删空，合并后的左兄弟成为新的根
         } 
         // 尝试把右兄弟合并过来
         else {    
@@ -345,6 +873,9 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
                 need_change_index = false;
 
             BPlusNode *right_sibling = parent->getChild(index + 1);
+            touch_leaf(right_sibling);
+            if(hot_cache)
+                hot_cache->invalidate(right_sibling->getKey(0));
             node->keys.insert(node->keys.end(), right_sibling->keys.begin(), right_sibling->keys.end());
             node->values.insert(node->values.end(), right_sibling->values.begin(), right_sibling->values.end());
             node->size += right_sibling->size;
@@ -352,6 +883,10 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
             parent->keys.erase(parent->keys.begin() + index);
             parent->children.erase(parent->children.begin() + index + 1);
             parent->size--;
+            if(order_stats){
+                parent->counts[index] += parent->counts[index + 1];
+                parent->counts.erase(parent->counts.begin() + index + 1);
+            }
             delete right_sibling;   // 释放内存
 
             if(need_change_index) {
@@ -361,8 +896,10 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
 
         // parent是根节点，且被删空：更新根结点
         if(parent == root){
-            if(parent->size == 0)
+            if(parent->size == 0){
                 root = node;
+                delete parent;
+            }
         }
         // parent不是根结点，且触发内部节点下溢
         else if (parent->size < nonleaf_min_degree-1) {
@@ -372,11 +909,11 @@ void BPlusTree::adjustLeafNode(BPlusNode *node, vector<BPlusNode*> path) {
 }
 
 // 调整内部节点
-void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
-    BPlusNode *node = path.back();  // 发生下溢的内部节点
-    path.pop_back();
-    BPlusNode *parent = path.back();    // 内部节点的父节点
-    int index = child_index(parent, node);
+void BPlusTree::adjustNonLeafNode(TreePath &path) {
+    BPlusNode *node = path.node();  // 发生下溢的内部节点
+    path.pop();
+    BPlusNode *parent = path.node();    // 内部节点的父节点
+    int index = path.slot();
 
     /****************  首先尝试：借  ****************/
     // 对于内部节点，借键实际上是借一个键的位置（借来后再确定键中的索引值），以及目标键对应的孩子（子树）
@@ -390,8 +927,16 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
         left_sibling->keys.pop_back();
         node->children.insert(node->children.begin(), left_sibling->getChild(left_sibling->getSize()));
         left_sibling->children.pop_back();
+        if(order_stats){
+            int moved = left_sibling->counts.back();
+            node->counts.insert(node->counts.begin(), moved);
+            left_sibling->counts.pop_back();
+            parent->counts[index - 1] -= moved;
+            parent->counts[index] += moved;
+        }
         left_sibling->size--;
         node->size++;
+        BPT_STAT_ADD(CNT_BORROWS, 1);
     }
     // 尝试从右兄弟节点中借一个键
     else if (index < parent->getSize() && parent->getChild(index + 1)->getSize() > nonleaf_min_degree-1) {
@@ -402,11 +947,20 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
         right_sibling->keys.erase(right_sibling->keys.begin());
         node->children.push_back(right_sibling->getChild(0));
         right_sibling->children.erase(right_sibling->children.begin());
+        if(order_stats){
+            int moved = right_sibling->counts.front();
+            node->counts.push_back(moved);
+            right_sibling->counts.erase(right_sibling->counts.begin());
+            parent->counts[index + 1] -= moved;
+            parent->counts[index] += moved;
+        }
         right_sibling->size--;
         node->size++; /////
+        BPT_STAT_ADD(CNT_BORROWS, 1);
     }
     /****************  不能借则尝试：合并  ****************/
     else {
+        BPT_STAT_ADD(CNT_MERGES, 1);
         if (index > 0) {
             BPlusNode *left_sibling = parent->getChild(index - 1);
             left_sibling->keys.push_back(parent->getKey(index - 1));
@@ -416,6 +970,11 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
             parent->keys.erase(parent->keys.begin() + index - 1);
             parent->children.erase(parent->children.begin() + index);
             parent->size--;
+            if(order_stats){
+                left_sibling->counts.insert(left_sibling->counts.end(), node->counts.begin(), node->counts.end());
+                parent->counts[index - 1] += parent->counts[index];
+                parent->counts.erase(parent->counts.begin() + index);
+            }
 
             // 释放内存
             delete node;
@@ -430,6 +989,11 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
             parent->keys.erase(parent->keys.begin() + index);
             parent->children.erase(parent->children.begin() + index + 1);
             parent->size--;
+            if(order_stats){
+                node->counts.insert(node->counts.end(), right_sibling->counts.begin(), right_sibling->counts.end());
+                parent->counts[index] += parent->counts[index + 1];
+                parent->counts.erase(parent->counts.begin() + index + 1);
+            }
 
             // 释放内存
             delete right_sibling;
@@ -437,8 +1001,10 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
 
         // 判断parent是不是根节点，且被删空：更新根结点，这时树的层数-1
         if(parent == root){
-            if(parent->size == 0)
+            if(parent->size == 0){
                 root = node;
+                delete parent;
+            }
         }
         // parent不是根结点，根据是否下溢决定是否递归调整内部节点
         else if (parent->size < nonleaf_min_degree-1) {
@@ -447,128 +1013,1345 @@ void BPlusTree::adjustNonLeafNode(vector<BPlusNode*> path) {
     }
 }
 
-// 判断节点是第几个孩子
-int BPlusTree::child_index(BPlusNode *parent, BPlusNode *node)
+// 往上改索引：沿路径记录的孩子位置往上找到第一个不是最左孩子的层
+void BPlusTree::change_index(BPlusNode *current_node, const TreePath &path)
 {
-    int i = 0;
-    for(; i < parent->size+1 && node != parent->children[i]; i++);
-    if(i < parent->size+1)
-        return i;
-    else    // node不是parent的孩子
-        return -1;
+    BPT_STAT_ADD(CNT_INDEX_CHANGES, 1);
+    key_type key = current_node->keys[0];
+    int d = path.depth - 1;
+    while(d > 0 && path.slots[d] == 0)
+        d--;
+    if(path.slots[d] > 0){ // 往上追溯到了根节点则不需要改索引，叶子是最左下叶子，否则更新索引
+        path.nodes[d]->keys[path.slots[d]-1] = key;
+    }
 }
 
-// 往上改索引
-void BPlusTree::change_index(BPlusNode *current_node, vector<BPlusNode*> path)
+
+/*******************    顺序统计     *********************/
+// 开启/关闭顺序统计：开启时为现有的树补算各子树的键数
+bool BPlusTree::enable_order_statistics(bool enable)
 {
-    key_type key = current_node->keys[0];
-    BPlusNode *parent = path.back();
-    path.pop_back();
-    int cindex = child_index(parent, current_node);
-    while(parent != root && cindex == 0){
-        current_node = parent;
-        parent = path.back();
-        path.pop_back();
-        cindex = child_index(parent, current_node);
+    if(enable && write_optimized){  // 缓冲中的消息是否新增了键要到达叶子才知道，无法维护子树计数
+        std::cerr << "Error: enable order statistics failed: write-optimized mode is on!" << endl;
+        return false;
     }
-    if(cindex > 0){ // 往上追溯到了根节点则不需要改索引，叶子是最左下叶子，否则更新索引
-        parent->keys[cindex-1] = key;
+    if(enable && !order_stats && root)
+        build_counts(root);
+    if(!enable && root){
+        vector<BPlusNode*> stack;
+        stack.push_back(root);
+        while(!stack.empty()){
+            BPlusNode *p = stack.back();
+            stack.pop_back();
+            if(!p->isLeaf()){
+                vector<int>().swap(p->counts);
+                stack.insert(stack.end(), p->children.begin(), p->children.end());
+            }
+        }
     }
+    order_stats = enable;
+    return true;
 }
 
-
-/*****************序列化与反序列化****************/
-// 从文件读入数据建树
-void BPlusTree::build_tree_from(string file_name)
+// 子树中的键数：叶节点为其大小，内部节点为各孩子计数之和
+int BPlusTree::subtree_count(BPlusNode *node)
 {
-    data_file = file_name;
-
-    from_file.open(file_name, std::ios::in);
-
-    // 文件存在
-    if(from_file.is_open()){    
-        // 文件不为空
-        if(from_file.peek() != std::fstream::traits_type::eof()) {
-            // 文件第一行为度数
-            int degree;
-            from_file >> degree;
-            set_degree(degree);
+    if(node->isLeaf())
+        return node->size;
+    int total = 0;
+    for(auto c : node->counts)
+        total += c;
+    return total;
+}
 
-            root = deserializeNodeFromFile();
-            cout << "Successfully deserialized and built a B-plus tree from file: " << file_name << endl;  
-        } 
-        else
-            cout << "Failed to deserialize: The file is empty." << endl;
+// 自底向上计算子树的计数
+void BPlusTree::build_counts(BPlusNode *node)
+{
+    if(node->isLeaf())
+        return;
+    node->counts.clear();
+    for(auto child : node->children){
+        build_counts(child);
+        node->counts.push_back(subtree_count(child));
     }
-    else
-        cout << "Failed to deserialize: The file does't exist." << endl;
-        
-
-    from_file.close();
-    cout << "Degree of the tree: " << leaf_max_degree << endl;
 }
 
-void BPlusTree::save_to_file()
+// 小于key（inclusive时为小于等于key）的键数
+int BPlusTree::rank_of(const key_type &key, bool inclusive)
 {
-    to_file.open(data_file);
+    if(root == nullptr)
+        return 0;
 
-    // 树不为空
-    if(root){
-        // 文件第一行写入度
-        to_file << leaf_max_degree << '\n';
-        serializeNodeToFile(root);
+    int before = 0;
+    int bound = inclusive ? 0 : 1;  // 非inclusive时等于key的键也要往左走
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= bound; i++)
+            before += p->counts[i];
+        p = p->getChild(i);
     }
-        
 
-    cout << "Updation saved to file." << endl;
-    to_file.close();
+    int j = 0;
+    for(; j < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(j)) >= bound; j++);
+    return before + j;
 }
 
-// 序列化B+树到文件
-void BPlusTree::serializeNodeToFile(BPlusNode* node)
+// 排名：树中小于key的键数，即key（若存在）从0开始的序号
+int BPlusTree::rank(const key_type &key)
 {
-    // if(node == nullptr){
-    //     cout << "function: serializeNodeToFile: failed, node is nullptr" << endl;
-    //     return;
-    // }
-
-    // 第一行：是否叶子节点     第二行：节点大小
-    int is_leaf = node->isLeaf() ? 1 : 0;
-    to_file << is_leaf << '\n' << node->getSize() << '\n';
-    // 第三行：keys 
-    for(auto key : node->keys)
-        to_file << key << " ";
-    to_file << '\n';
-    // 判断是否是叶子节点      
-    if(is_leaf){    //  是，第四行写valus
-        for(auto value : node->values)
-            to_file << value << " ";
-        to_file << '\n';
-    }
-    else{   // 不是：递归写入孩子节点
-        for(auto child : node->children)
-            serializeNodeToFile(child);
+    if(!order_stats){
+        std::cerr << "Error: rank failed: order statistics are not enabled!" << endl;
+        return -1;
     }
+    return rank_of(key, false);
 }
 
-// 从文件反序列化B+树到内存
-BPlusNode* BPlusTree::deserializeNodeFromFile()
+// 选择：找到第k小（从0开始）的键值对
+bool BPlusTree::select(int k, key_type &key, value_type &value)
 {
-    BPlusNode *node = new BPlusNode();
-    static BPlusNode *last_leaf = nullptr;
+    TierGuard tier_guard(tierer);
+    if(!order_stats){
+        std::cerr << "Error: select failed: order statistics are not enabled!" << endl;
+        return false;
+    }
+    if(root == nullptr || k < 0 || k >= subtree_count(root)){
+        std::cerr << "Error: select failed: index '" << k << "' out of range!" << endl;
+        return false;
+    }
 
-    int is_leaf, size;
-    from_file >> is_leaf >> size;
-    if(is_leaf)
-        node->leaf = true;
-    else    
-        node->leaf = false;
-    node->size = size;
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && k >= p->counts[i]; i++)
+            k -= p->counts[i];
+        p = p->getChild(i);
+    }
+    touch_leaf(p);
+    key = p->getKey(k);
+    value = p->getValue(k);
+    return true;
+}
 
-    int key;
-    for(int i = 0; i < size; i++){
-        from_file >> key;
-        node->keys.push_back(key);
+// 统计[lo, hi]内的键数
+int BPlusTree::countRange(const key_type &lo, const key_type &hi)
+{
+    if(!order_stats){
+        std::cerr << "Error: count failed: order statistics are not enabled!" << endl;
+        return -1;
+    }
+    if(BPlusNode::cmpKeys(lo, hi) > 0)
+        return 0;
+    return rank_of(hi, true) - rank_of(lo, false);
+}
+
+
+/*******************    范围删除     *********************/
+// 删除[lo, hi]内的所有键，返回删除的键数
+// 完全落在区间内的子树整棵摘下释放，只修剪两条边界路径上的节点，之后统一修复叶子链表、下溢和索引
+int BPlusTree::deleteRange(const key_type &lo, const key_type &hi)
+{
+    BPT_STAT_TIMER(OP_DELETE_RANGE);
+    TierGuard tier_guard(tierer);
+    if(recorder)
+        recorder->recordRange(TRACE_DELETE_RANGE, lo, hi);
+    note_write(lo, hi);
+    if(write_optimized)
+        flush_all();
+    if(getRoot() == nullptr){
+        std::cerr << "Error: delete failed: tree is empty!" << endl;
+        return 0;
+    }
+    if(BPlusNode::cmpKeys(lo, hi) > 0)
+        return 0;
+    if(hot_cache)
+        hot_cache->invalidateRange(lo, hi);
+    if(learned_index)
+        learned_index->invalidate();
+
+    // 删除前确定区间左侧保留的最后一个叶子before：lo所在叶子若有小于lo的键则是它，否则是它的前驱叶子
+    BPlusNode *p = root, *left_neighbor = nullptr, *before = nullptr;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(lo, p->getKey(i)) >= 0; i++);
+        if(i > 0)
+            left_neighbor = p->getChild(i-1);
+        p = p->getChild(i);
+    }
+    if(BPlusNode::cmpKeys(p->getKey(0), lo) < 0)
+        before = p;
+    else if(left_neighbor){
+        before = left_neighbor;
+        while(!before->isLeaf())
+            before = before->getChild(before->getSize());
+    }
+
+    // 以及区间右侧第一个保留的键after_key
+    p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(hi, p->getKey(i)) >= 0; i++);
+        p = p->getChild(i);
+    }
+    int j = 0;
+    for(; j < p->getSize() && BPlusNode::cmpKeys(p->getKey(j), hi) <= 0; j++);
+    bool has_after = true;
+    key_type after_key;
+    if(j < p->getSize())
+        after_key = p->getKey(j);
+    else if(p->next_leaf)
+        after_key = p->next_leaf->getKey(0);
+    else
+        has_after = false;
+
+    // 第一遍：修剪边界路径，释放被完全覆盖的子树
+    int removed = 0;
+    if(trim_range(root, lo, hi, removed)){
+        delete root;
+        root = nullptr;
+        return removed;
+    }
+
+    // 接上叶子链表：before直接指向after_key所在的叶子
+    BPlusNode *after = nullptr;
+    if(has_after){
+        after = root;
+        while(!after->isLeaf()){
+            int i = 0;
+            for(; i < after->getSize() && BPlusNode::cmpKeys(after_key, after->getKey(i)) >= 0; i++);
+            after = after->getChild(i);
+        }
+    }
+    if(before && before != after)
+        before->next_leaf = after;
+
+    // 第二遍：沿边界路径自底向上修复下溢
+    repair_range(root, lo, hi);
+    while(!root->isLeaf() && root->getSize() == 0){   // 根结点只剩一个孩子：树的层数-1
+        BPlusNode *old_root = root;
+        root = root->getChild(0);
+        delete old_root;
+    }
+
+    // 修复索引：指向after_key所在子树的索引可能还是已被删除的键
+    if(has_after){
+        TreePath path;
+        p = root;
+        while(!p->isLeaf()){
+            int i = 0;
+            for(; i < p->getSize() && BPlusNode::cmpKeys(after_key, p->getKey(i)) >= 0; i++);
+            path.push(p, i);
+            p = p->getChild(i);
+        }
+        if(!path.empty() && BPlusNode::cmpKeys(p->getKey(0), after_key) == 0)
+            change_index(p, path);
+    }
+
+    return removed;
+}
+
+// 删除子树中落在[lo, hi]内的键：完全被覆盖的孩子整棵释放，两端的孩子递归修剪，删空的孩子从节点中摘掉
+// 返回该子树是否已被删空（节点本身由调用者释放）
+bool BPlusTree::trim_range(BPlusNode *node, const key_type &lo, const key_type &hi, int &removed)
+{
+    if(node->isLeaf()){
+        int first = find_key_index(node, lo);
+        int last = first;
+        for(; last < node->size && BPlusNode::cmpKeys(node->keys[last], hi) <= 0; last++);
+        touch_leaf(node);
+        node->keys.erase(node->keys.begin() + first, node->keys.begin() + last);
+        node->values.erase(node->values.begin() + first, node->values.begin() + last);
+        node->size -= last - first;
+        removed += last - first;
+        return node->size == 0;
+    }
+
+    // 与区间相交的孩子为 [first, last]
+    int first = 0;
+    for(; first < node->size && BPlusNode::cmpKeys(lo, node->keys[first]) >= 0; first++);
+    int last = first;
+    for(; last < node->size && BPlusNode::cmpKeys(hi, node->keys[last]) >= 0; last++);
+
+    for(int i = first + 1; i < last; i++)
+        removed += free_subtree(node->children[i]);
+    bool first_empty = trim_range(node->children[first], lo, hi, removed);
+    bool last_empty = first_empty;
+    if(last > first)
+        last_empty = trim_range(node->children[last], lo, hi, removed);
+
+    if(first_empty)
+        delete node->children[first];
+    if(last > first && last_empty)
+        delete node->children[last];
+    if(order_stats){    // 被修剪的两端孩子重新计数，被摘掉的孩子的计数随后一起删除
+        if(!first_empty)
+            node->counts[first] = subtree_count(node->children[first]);
+        if(!last_empty)
+            node->counts[last] = subtree_count(node->children[last]);
+    }
+
+    // 摘掉孩子 [from, to] 以及对应的索引
+    int from = first_empty ? first : first + 1;
+    int to = last_empty ? last : last - 1;
+    if(from <= to){
+        int key_from = from > 0 ? from - 1 : 0;
+        int key_to = from > 0 ? to : std::min(to + 1, node->size);
+        node->keys.erase(node->keys.begin() + key_from, node->keys.begin() + key_to);
+        node->children.erase(node->children.begin() + from, node->children.begin() + to + 1);
+        if(order_stats)
+            node->counts.erase(node->counts.begin() + from, node->counts.begin() + to + 1);
+        if(!node->buffer.empty())   // 写优化模式下消息已全部推到叶子，只需保持分区与孩子对齐
+            node->buffer.erase(node->buffer.begin() + from, node->buffer.begin() + to + 1);
+        node->size = node->keys.size();
+    }
+    return node->children.empty();
+}
+
+// 沿lo和hi的路径自底向上修复被修剪过的节点
+void BPlusTree::repair_range(BPlusNode *node, const key_type &lo, const key_type &hi)
+{
+    if(node->isLeaf())
+        return;
+
+    int first = 0;
+    for(; first < node->size && BPlusNode::cmpKeys(lo, node->keys[first]) >= 0; first++);
+    int last = first;
+    for(; last < node->size && BPlusNode::cmpKeys(hi, node->keys[last]) >= 0; last++);
+
+    repair_range(node->children[first], lo, hi);
+    if(last > first)
+        repair_range(node->children[last], lo, hi);
+    repair_children(node);
+}
+
+// 修复node中所有下溢的孩子；node只剩一个孩子时无法修复，留给上一层处理
+void BPlusTree::repair_children(BPlusNode *node)
+{
+    int i = 0;
+    while(node->size > 0 && i <= node->size){
+        if(is_underflow(node->children[i]))
+            i = rebalance_child(node, i);
+        else
+            i++;
+    }
+}
+
+// 把下溢的孩子与相邻兄弟合并，合并后超出上限则重新均分为两个节点；返回合并后节点的位置
+// 与逐个删除时的借/合并不同，这里的孩子可能下溢任意多个键
+int BPlusTree::rebalance_child(BPlusNode *parent, int index)
+{
+    int l = index > 0 ? index - 1 : index;
+    BPlusNode *left = parent->children[l], *right = parent->children[l + 1];
+
+    // 合并right到left
+    if(left->isLeaf()){
+        touch_leaf(left);
+        touch_leaf(right);
+        if(hot_cache && right->size > 0)    // 叶子边界移动，见split_leaf
+            hot_cache->invalidate(right->keys[0]);
+        left->keys.insert(left->keys.end(), right->keys.begin(), right->keys.end());
+        left->values.insert(left->values.end(), right->values.begin(), right->values.end());
+        left->next_leaf = right->next_leaf;
+    }
+    else{
+        if(!left->buffer.empty() || !right->buffer.empty()){    // 缓冲分区随孩子一起拼接
+            ensure_buffer(left);
+            ensure_buffer(right);
+            left->buffer.insert(left->buffer.end(), std::make_move_iterator(right->buffer.begin()),
+                                std::make_move_iterator(right->buffer.end()));
+            left->buffered += right->buffered;
+        }
+        left->keys.push_back(parent->keys[l]);
+        left->keys.insert(left->keys.end(), right->keys.begin(), right->keys.end());
+        left->children.insert(left->children.end(), right->children.begin(), right->children.end());
+        if(order_stats)
+            left->counts.insert(left->counts.end(), right->counts.begin(), right->counts.end());
+    }
+    left->size = left->keys.size();
+    parent->keys.erase(parent->keys.begin() + l);
+    parent->children.erase(parent->children.begin() + l + 1);
+    parent->size--;
+    if(order_stats){
+        parent->counts[l] += parent->counts[l + 1];
+        parent->counts.erase(parent->counts.begin() + l + 1);
+    }
+    if(!parent->buffer.empty()){    // 两个孩子对应的分区也合并
+        parent->buffer[l].insert(parent->buffer[l].end(), std::make_move_iterator(parent->buffer[l + 1].begin()),
+                                 std::make_move_iterator(parent->buffer[l + 1].end()));
+        parent->buffer.erase(parent->buffer.begin() + l + 1);
+    }
+    delete right;
+    BPT_STAT_ADD(CNT_MERGES, 1);
+
+    int max_keys = left->isLeaf() ? leaf_max_degree - 1 : nonleaf_max_degree - 1;
+    if(left->size <= max_keys){
+        if(!left->isLeaf())
+            repair_children(left);  // 合并后原先无法修复的孙子节点有了兄弟
+        return l;
+    }
+
+    // 超出上限：均分
+    BPlusNode *new_node;
+    key_type split_key;
+    int keep = left->size / 2;
+    if(left->isLeaf()){
+        vector<key_type> tail_keys(left->keys.begin() + keep, left->keys.end());
+        vector<value_type> tail_values(left->values.begin() + keep, left->values.end());
+        new_node = new BPlusNode(true, tail_keys.size(), tail_keys, tail_values);
+        reserve_node(new_node);
+        new_node->next_leaf = left->next_leaf;
+        left->next_leaf = new_node;
+        left->keys.resize(keep);
+        left->values.resize(keep);
+        split_key = new_node->keys[0];
+        if(hot_cache)
+            hot_cache->invalidate(split_key);
+    }
+    else{
+        split_key = left->keys[keep];
+        vector<key_type> tail_keys(left->keys.begin() + keep + 1, left->keys.end());
+        vector<BPlusNode*> tail_children(left->children.begin() + keep + 1, left->children.end());
+        new_node = new BPlusNode(false, tail_keys.size(), tail_keys, tail_children);
+        reserve_node(new_node);
+        if(order_stats){
+            new_node->counts.assign(left->counts.begin() + keep + 1, left->counts.end());
+            left->counts.resize(keep + 1);
+        }
+        if(!left->buffer.empty()){
+            new_node->buffer.assign(std::make_move_iterator(left->buffer.begin() + keep + 1),
+                                    std::make_move_iterator(left->buffer.end()));
+            left->buffer.resize(keep + 1);
+            new_node->buffered = partition_total(new_node->buffer);
+            left->buffered -= new_node->buffered;
+        }
+        left->keys.resize(keep);
+        left->children.resize(keep + 1);
+    }
+    left->size = keep;
+    parent->keys.insert(parent->keys.begin() + l, split_key);
+    parent->children.insert(parent->children.begin() + l + 1, new_node);
+    parent->size++;
+    if(order_stats){
+        parent->counts[l] = subtree_count(left);
+        parent->counts.insert(parent->counts.begin() + l + 1, subtree_count(new_node));
+    }
+    if(!parent->buffer.empty()){
+        parent->buffer.emplace(parent->buffer.begin() + l + 1);
+        split_partition(parent->buffer[l], parent->buffer[l + 1], split_key);
+    }
+    BPT_STAT_ADD(CNT_BORROWS, 1);
+
+    if(!left->isLeaf()){
+        repair_children(left);
+        repair_children(new_node);
+    }
+    return l;
+}
+
+// 判断节点是否下溢（非根节点）；只有一个孩子的内部节点总是视为下溢
+bool BPlusTree::is_underflow(BPlusNode *node)
+{
+    if(node->isLeaf())
+        return node->size < leaf_min_degree - 1;
+    return node->size < std::max(nonleaf_min_degree - 1, 1);
+}
+
+// 释放整棵子树，返回其中的键数
+int BPlusTree::free_subtree(BPlusNode *node)
+{
+    int freed_keys = 0;
+    vector<BPlusNode*> stack;
+    stack.push_back(node);
+    while(!stack.empty()){
+        BPlusNode *p = stack.back();
+        stack.pop_back();
+        if(p->isLeaf())
+            freed_keys += p->size;
+        else
+            stack.insert(stack.end(), p->children.begin(), p->children.end());
+        delete p;
+    }
+    return freed_keys;
+}
+
+
+/*******************    分裂与拼接     *********************/
+// 把树从key处一分为二：小于key的键留在本树，其余移到空树right中（right沿用本树的度数与顺序统计设置）
+// 沿key的查找路径自底向上，把路径上每个节点按孩子位置切成左右两半，再分别与下一层切出的子树拼接，
+// 只有路径上及接缝处的节点被修改，不逐个搬动键
+bool BPlusTree::split_at(const key_type &key, BPlusTree &right)
+{
+    TierGuard tier_guard(tierer), right_guard(right.tierer);
+    abort_restructure();
+    if(&right == this || right.root){
+        std::cerr << "Error: split failed: target tree is not empty!" << endl;
+        return false;
+    }
+    if(order_stats && right.write_optimized){
+        std::cerr << "Error: split failed: target tree is in write-optimized mode!" << endl;
+        return false;
+    }
+    flush_all();
+    right.apply_degrees(leaf_max_degree, nonleaf_max_degree);
+    right.order_stats = order_stats;
+    if(!root)
+        return true;
+    if(hot_cache)
+        hot_cache->invalidateRange(key, std::numeric_limits<key_type>::max());
+    if(learned_index)   // 叶子被分给了两棵树
+        learned_index->invalidate();
+    if(right.learned_index)
+        right.learned_index->invalidate();
+
+    TreePath path;
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+        path.push(p, i);
+        p = p->getChild(i);
+    }
+
+    // 叶子：不小于key的键移到新叶子中
+    BPlusNode *left = p, *right_part = nullptr;
+    int j = find_key_index(p, key);
+    if(j == 0){
+        right_part = p;
+        left = nullptr;
+    }
+    else if(j < p->size){
+        touch_leaf(p);
+        right_part = new BPlusNode(true, p->size - j);
+        reserve_node(right_part);
+        right_part->keys.assign(p->keys.begin() + j, p->keys.end());
+        right_part->values.assign(std::make_move_iterator(p->values.begin() + j),
+                                  std::make_move_iterator(p->values.end()));
+        right_part->next_leaf = p->next_leaf;
+        p->keys.resize(j);
+        p->values.resize(j);
+        p->size = j;
+    }
+    int hl = 0, hr = 0;
+
+    // 自底向上切开路径上的节点：孩子i左边的部分并入左树，右边的部分并入右树
+    for(int level = path.depth - 1; level >= 0; level--){
+        BPlusNode *n = path.nodes[level];
+        int i = path.slots[level];
+        int h = path.depth - level;
+        if(!n->buffer.empty())      // 消息已推完，空分区直接释放
+            vector<vector<Message>>().swap(n->buffer);
+
+        BPlusNode *rn = nullptr;
+        int hrn = h;
+        key_type right_sep;
+        if(i < n->size){
+            right_sep = n->keys[i];
+            rn = new BPlusNode(false, n->size - i - 1);
+            reserve_node(rn);
+            rn->keys.assign(n->keys.begin() + i + 1, n->keys.end());
+            rn->children.assign(n->children.begin() + i + 1, n->children.end());
+            if(order_stats)
+                rn->counts.assign(n->counts.begin() + i + 1, n->counts.end());
+            if(rn->size == 0){      // 只有一个孩子：直接用这个孩子
+                BPlusNode *only = rn->children[0];
+                delete rn;
+                rn = only;
+                hrn--;
+            }
+        }
+
+        BPlusNode *ln = nullptr;
+        int hln = h;
+        key_type left_sep;
+        if(i > 0){
+            left_sep = n->keys[i-1];
+            n->keys.resize(i - 1);
+            n->children.resize(i);
+            if(order_stats)
+                n->counts.resize(i);
+            n->size = i - 1;
+            ln = n;
+            if(n->size == 0){
+                ln = n->children[0];
+                delete n;
+                hln--;
+            }
+        }
+        else
+            delete n;
+
+        if(rn)
+            right_part = join_subtrees(right_part, hr, right_sep, rn, hrn, hr);
+        if(ln)
+            left = join_subtrees(ln, hln, left_sep, left, hl, hl);
+    }
+
+    // 接缝处断开叶子链表
+    root = left;
+    if(root){
+        p = root;
+        while(!p->isLeaf())
+            p = p->getChild(p->getSize());
+        p->next_leaf = nullptr;
+    }
+    right.root = right_part;
+    return true;
+}
+
+// 把other拼接到本树上：两棵树的键区间不能重叠，other可以整体在本树的左边或右边；完成后other为空
+// 较矮的一棵挂到较高一棵的边界路径上，只修复接缝处的索引、叶子链表以及下溢/溢出
+bool BPlusTree::join(BPlusTree &&other)
+{
+    if(&other == this)
+        return true;
+    TierGuard tier_guard(tierer), other_guard(other.tierer);
+    abort_restructure();
+    other.abort_restructure();
+    if(other.leaf_max_degree != leaf_max_degree || other.nonleaf_max_degree != nonleaf_max_degree){
+        std::cerr << "Error: join failed: the trees have different degrees!" << endl;
+        return false;
+    }
+    if(other.order_stats != order_stats){
+        std::cerr << "Error: join failed: order statistics are enabled in only one tree!" << endl;
+        return false;
+    }
+    flush_all();
+    other.flush_all();
+    if(other.root == nullptr)
+        return true;
+
+    BPlusNode *a = root, *b = other.root;
+    if(a){
+        // 确定两棵树的先后：a在左，b在右
+        BPlusNode *a_first = a, *a_last = a, *b_first = b, *b_last = b;
+        while(!a_first->isLeaf())
+            a_first = a_first->getChild(0);
+        while(!a_last->isLeaf())
+            a_last = a_last->getChild(a_last->getSize());
+        while(!b_first->isLeaf())
+            b_first = b_first->getChild(0);
+        while(!b_last->isLeaf())
+            b_last = b_last->getChild(b_last->getSize());
+        if(BPlusNode::cmpKeys(b_last->keys.back(), a_first->keys[0]) < 0){
+            std::swap(a, b);
+            std::swap(a_last, b_last);
+            std::swap(a_first, b_first);
+        }
+        else if(BPlusNode::cmpKeys(a_last->keys.back(), b_first->keys[0]) >= 0){
+            std::cerr << "Error: join failed: key ranges of the trees overlap!" << endl;
+            return false;
+        }
+
+        a_last->next_leaf = b_first;
+        int height;
+        root = join_subtrees(a, subtree_height(a), b_first->keys[0], b, subtree_height(b), height);
+    }
+    else
+        root = b;
+
+    // 本树缓存中的键仍然有效；学习索引的叶子目录不含other的叶子，且接缝处可能有叶子被合并
+    if(learned_index)
+        learned_index->invalidate();
+    other.root = nullptr;
+    other.buffered_messages = 0;
+    if(other.hot_cache)
+        other.hot_cache->clear();
+    if(other.learned_index)
+        other.learned_index->invalidate();
+    return true;
+}
+
+// 子树的高度，叶子为0
+int BPlusTree::subtree_height(BPlusNode *node)
+{
+    int h = 0;
+    for(; !node->isLeaf(); h++)
+        node = node->getChild(0);
+    return h;
+}
+
+// 拼接两棵子树：a中的键都小于b中的键，sep是两者之间的索引键，ha/hb为高度；返回拼接后的根，height为其高度
+// 两棵可能都是原先的根（允许下溢）：挂上去后若下溢则与相邻的兄弟合并或均分，父节点溢出则沿边界路径往上分裂
+BPlusNode *BPlusTree::join_subtrees(BPlusNode *a, int ha, const key_type &sep, BPlusNode *b, int hb, int &height)
+{
+    if(a == nullptr || b == nullptr){
+        height = a ? ha : hb;
+        return a ? a : b;
+    }
+
+    BPlusNode *top, *p;
+    TreePath path;
+    if(ha == hb){
+        top = new BPlusNode(false, 1);
+        reserve_node(top);
+        top->keys.push_back(sep);
+        top->children.push_back(a);
+        top->children.push_back(b);
+        if(order_stats){
+            top->counts.push_back(subtree_count(a));
+            top->counts.push_back(subtree_count(b));
+        }
+        height = ha + 1;
+        if(is_underflow(a) || is_underflow(b))
+            rebalance_child(top, is_underflow(a) ? 0 : 1);
+        if(top->size == 0){     // 两者合并成了一个节点
+            BPlusNode *only = top->children[0];
+            delete top;
+            height--;
+            return only;
+        }
+        return top;
+    }
+
+    if(ha > hb){    // b挂到a最右边路径上高度为hb+1的节点
+        int count = order_stats ? subtree_count(b) : 0;
+        top = p = a;
+        for(int h = ha; ; h--){
+            if(!p->buffer.empty())
+                vector<vector<Message>>().swap(p->buffer);
+            if(h == hb + 1)
+                break;
+            if(order_stats)
+                p->counts[p->size] += count;
+            path.push(p, p->size);
+            p = p->children[p->size];
+        }
+        p->keys.push_back(sep);
+        p->children.push_back(b);
+        if(order_stats)
+            p->counts.push_back(count);
+        p->size++;
+        if(is_underflow(b))
+            rebalance_child(p, p->size);
+        height = ha;
+    }
+    else{           // a挂到b最左边路径上高度为ha+1的节点
+        int count = order_stats ? subtree_count(a) : 0;
+        top = p = b;
+        for(int h = hb; ; h--){
+            if(!p->buffer.empty())
+                vector<vector<Message>>().swap(p->buffer);
+            if(h == ha + 1)
+                break;
+            if(order_stats)
+                p->counts[0] += count;
+            path.push(p, 0);
+            p = p->children[0];
+        }
+        p->keys.insert(p->keys.begin(), sep);
+        p->children.insert(p->children.begin(), a);
+        if(order_stats)
+            p->counts.insert(p->counts.begin(), count);
+        p->size++;
+        if(is_underflow(a))
+            rebalance_child(p, 0);
+        height = hb;
+    }
+
+    // 挂上孩子的节点溢出：沿路径往上分裂，到顶则长出新的根
+    while(p->size >= nonleaf_max_degree){
+        BPlusNode *new_node;
+        key_type split_key = split_nonleaf(p, new_node);
+        BPT_STAT_ADD(CNT_SPLITS, 1);
+        if(path.empty()){
+            BPlusNode *new_top = new BPlusNode(false, 1);
+            reserve_node(new_top);
+            new_top->keys.push_back(split_key);
+            new_top->children.push_back(p);
+            new_top->children.push_back(new_node);
+            if(order_stats){
+                new_top->counts.push_back(subtree_count(p));
+                new_top->counts.push_back(subtree_count(new_node));
+            }
+            top = new_top;
+            height++;
+            break;
+        }
+        insert_into_nonleaf(path.node(), path.slot(), split_key, new_node);
+        p = path.node();
+        path.pop();
+    }
+    return top;
+}
+
+
+/*******************    写优化（消息缓冲）     *********************/
+// 开启/关闭写优化模式：插入/修改/删除先作为消息放进根结点的缓冲，缓冲满了再成批往下推，查找时沿途查看缓冲
+// capacity为每个内部节点缓冲的消息数上限，<=0时按度数取默认值；关闭时先把所有消息推到叶子
+bool BPlusTree::set_write_optimized(bool enable, int capacity)
+{
+    if(enable && order_stats){
+        cout << "Failed to enable write-optimized mode: order statistics are enabled!" << endl;
+        return false;
+    }
+    if(enable && learned_index){    // 内部节点的缓冲必须在下降时查看，不能跳过
+        cout << "Failed to enable write-optimized mode: learned index is enabled!" << endl;
+        return false;
+    }
+    if(!enable && write_optimized && root && !root->isLeaf()){   // 推完所有消息并释放各节点的缓冲分区
+        drain_node(root);
+        fix_root();
+    }
+    write_optimized = enable;
+    buffer_capacity = capacity > 0 ? capacity : std::max(256, nonleaf_max_degree * 4);
+    return true;
+}
+
+// 尚未作用到叶子的消息数
+long BPlusTree::pending_messages()
+{
+    return buffered_messages;
+}
+
+// 把所有缓冲的消息推到叶子：范围查询、范围删除、保存等需要叶子反映全部修改的操作先调用它
+void BPlusTree::flush_all()
+{
+    TierGuard tier_guard(tierer);
+    if(root == nullptr || root->isLeaf() || buffered_messages == 0)
+        return;
+    drain_node(root);
+    fix_root();
+}
+
+// 较新的消息newer合并到同一个键较旧的消息older上
+static void combine_message(Message &older, Message &&newer)
+{
+    if(newer.type == MSG_UPDATE){
+        if(older.type != MSG_DELETE)    // 插入后修改仍是插入，修改后再修改取新值；删除后修改无效
+            older.value = std::move(newer.value);
+        return;
+    }
+    older = std::move(newer);
+}
+
+static bool message_less(const Message &m, const key_type &key)
+{
+    return BPlusNode::cmpKeys(m.key, key) < 0;
+}
+
+// 节点的缓冲按孩子分区：没有消息时不分配，有消息时每个孩子对应一个分区
+void BPlusTree::ensure_buffer(BPlusNode *node)
+{
+    if(node->buffer.empty())
+        node->buffer.resize(node->children.size());
+}
+
+// 写入一条消息：树只有一层时直接作用到叶子，否则放进根结点的缓冲，满了则往下推一批
+void BPlusTree::put_message(Message &&msg)
+{
+    // 已缓存的键一定存在：插入/修改消息直接改写缓存中的值，删除消息作废
+    if(hot_cache){
+        if(msg.type == MSG_DELETE)
+            hot_cache->invalidate(msg.key);
+        else
+            hot_cache->update(msg.key, msg.value);
+    }
+
+    if(root == nullptr){
+        if(msg.type != MSG_PUT)
+            return;
+        root = new BPlusNode(true, 0);
+        reserve_node(root);
+    }
+
+    if(root->isLeaf()){
+        buffered_messages++;
+        apply_messages(root, &msg, &msg + 1);
+    }
+    else{
+        int i = 0;
+        for(; i < root->getSize() && BPlusNode::cmpKeys(msg.key, root->getKey(i)) >= 0; i++);
+        add_message(root, i, std::move(msg));
+    }
+    fix_root();
+
+    // 根结点的缓冲满了则往下推，推完后根可能长高或变矮
+    while(root && !root->isLeaf() && root->buffered > buffer_capacity){
+        flush_node(root);
+        fix_root();
+    }
+}
+
+// 消息放进节点缓冲中第index个孩子的分区：同一个键已有较旧的消息时合并为一条
+void BPlusTree::add_message(BPlusNode *node, int index, Message &&msg)
+{
+    ensure_buffer(node);
+    vector<Message> &part = node->buffer[index];
+    auto it = std::lower_bound(part.begin(), part.end(), msg.key, message_less);
+    if(it != part.end() && BPlusNode::cmpKeys(it->key, msg.key) == 0)
+        combine_message(*it, std::move(msg));
+    else{
+        part.insert(it, std::move(msg));
+        node->buffered++;
+        buffered_messages++;
+    }
+}
+
+// 把父节点推下来的一批有序消息按孩子分段，归并进内部节点对应的分区
+void BPlusTree::merge_messages(BPlusNode *node, Message *first, Message *last)
+{
+    ensure_buffer(node);
+    int i = 0;
+    while(first != last){
+        for(; i < node->size && BPlusNode::cmpKeys(first->key, node->keys[i]) >= 0; i++);
+        Message *run = first;
+        while(first != last && (i == node->size || BPlusNode::cmpKeys(first->key, node->keys[i]) < 0))
+            ++first;
+        int combined = merge_partition(node->buffer[i], run, first);
+        node->buffered += (first - run) - combined;
+        buffered_messages -= combined;
+    }
+}
+
+// 一段有序消息归并进一个分区，推下来的消息更新；返回与已有消息合并掉的条数
+// 从尾部往前原地归并，不分配临时数组；同一个键的两条消息合并后在前面留下的空位最后一起去掉
+int BPlusTree::merge_partition(vector<Message> &part, Message *first, Message *last)
+{
+    long n = part.size(), m = last - first;
+    part.resize(n + m);
+    Message *buf = part.data();
+    long i = n - 1, j = m - 1, w = n + m - 1;
+    while(j >= 0){
+        int cmp = i >= 0 ? BPlusNode::cmpKeys(buf[i].key, first[j].key) : -1;
+        if(cmp > 0)
+            buf[w--] = std::move(buf[i--]);
+        else if(cmp == 0){
+            combine_message(buf[i], std::move(first[j--]));
+            buf[w--] = std::move(buf[i--]);
+        }
+        else
+            buf[w--] = std::move(first[j--]);
+    }
+    int combined = w - i;
+    if(combined > 0)
+        part.erase(part.begin() + i + 1, part.begin() + w + 1);
+    return combined;
+}
+
+// 把一批有序消息一次性归并进叶节点，叶子可能因此超出上限或下溢，由调用者修复
+// 归并结果写入复用的临时数组后与叶子交换，叶子原来的数组留作下一次的临时数组
+void BPlusTree::apply_messages(BPlusNode *leaf, Message *first, Message *last)
+{
+    buffered_messages -= last - first;
+    touch_leaf(leaf);
+    vector<key_type> &keys = scratch_keys;
+    vector<value_type> &values = scratch_values;
+    keys.clear();
+    values.clear();
+    keys.reserve(std::max<long>(leaf_max_degree, leaf->size + (last - first)));
+    values.reserve(keys.capacity());
+
+    int i = 0;
+    for(; first != last; ++first){
+        for(; i < leaf->size && BPlusNode::cmpKeys(leaf->keys[i], first->key) < 0; i++){
+            keys.push_back(leaf->keys[i]);
+            values.push_back(std::move(leaf->values[i]));
+        }
+        bool exists = i < leaf->size && BPlusNode::cmpKeys(leaf->keys[i], first->key) == 0;
+        if(exists)
+            i++;
+        if(first->type == MSG_PUT || (first->type == MSG_UPDATE && exists)){
+            keys.push_back(first->key);
+            values.push_back(std::move(first->value));
+        }
+    }
+    for(; i < leaf->size; i++){
+        keys.push_back(leaf->keys[i]);
+        values.push_back(std::move(leaf->values[i]));
+    }
+
+    leaf->keys.swap(keys);
+    leaf->values.swap(values);
+    leaf->size = leaf->keys.size();
+}
+
+// 缓冲满了：把消息最多的那个分区整批推给对应的孩子，再修复孩子
+void BPlusTree::flush_node(BPlusNode *node)
+{
+    BPT_STAT_ADD(CNT_FLUSHES, 1);
+    int best = 0;
+    for(int i = 1; i <= node->size; i++)
+        if(node->buffer[i].size() > node->buffer[best].size())
+            best = i;
+
+    BPlusNode *child = node->children[best];
+    vector<Message> &part = node->buffer[best];
+    if(child->isLeaf())
+        apply_messages(child, part.data(), part.data() + part.size());
+    else
+        merge_messages(child, part.data(), part.data() + part.size());
+    node->buffered -= part.size();
+    part.clear();
+
+    // 孩子的缓冲也满了则在修复孩子时继续往下推
+    fix_children(node, best, best);
+}
+
+// 把子树中所有缓冲的消息推到叶子
+void BPlusTree::drain_node(BPlusNode *node)
+{
+    for(int i = 0; i < (int)node->buffer.size(); i++){
+        vector<Message> &part = node->buffer[i];
+        if(part.empty())
+            continue;
+        if(node->children[i]->isLeaf())
+            apply_messages(node->children[i], part.data(), part.data() + part.size());
+        else
+            merge_messages(node->children[i], part.data(), part.data() + part.size());
+    }
+    vector<vector<Message>>().swap(node->buffer);
+    node->buffered = 0;
+
+    for(auto child : node->children)
+        if(!child->isLeaf())
+            drain_node(child);
+    fix_children(node, 0, node->size);
+}
+
+// 一批消息作用之后修复node中位置在[lo, hi]内的孩子：先把超出上限的切开，再合并下溢的
+// 合并会把两个缓冲并在一起，超出容量的再往下推，推完后孩子的大小又可能变化，直到都满足要求为止
+// 只检查被改动过的孩子，下推一批消息不需要访问所有孩子
+void BPlusTree::fix_children(BPlusNode *node, int lo, int hi)
+{
+    bool flushed = true;
+    while(flushed){
+        for(int i = lo; i <= hi; i++){
+            BPlusNode *child = node->children[i];
+            int max_keys = child->isLeaf() ? leaf_max_degree - 1 : nonleaf_max_degree - 1;
+            if(child->size > max_keys){
+                int added = split_child(node, i);
+                i += added;
+                hi += added;
+            }
+        }
+
+        for(int i = lo; node->size > 0 && i <= hi; ){
+            if(is_underflow(node->children[i])){
+                int old_size = node->size;
+                i = rebalance_child(node, i);   // 与左兄弟合并时窗口往左扩一格，合并后（可能又均分）右边的孩子整体移动
+                int delta = node->size - old_size;
+                lo = std::min(lo, i);
+                hi = std::min(std::max(hi + delta, i + 1 + delta), node->size);
+            }
+            else
+                i++;
+        }
+
+        flushed = false;
+        for(int i = lo; i <= hi; i++){
+            BPlusNode *child = node->children[i];
+            while(!child->isLeaf() && child->buffered > buffer_capacity){
+                flush_node(child);
+                flushed = true;
+            }
+        }
+    }
+}
+
+// 把超出上限的孩子均匀切成若干个节点，返回新增的节点数
+// 一批消息可能让节点一次超出上限很多，不能像逐个插入时那样只分裂成两个
+int BPlusTree::split_child(BPlusNode *parent, int index)
+{
+    BPlusNode *child = parent->children[index];
+    vector<BPlusNode*> pieces;
+    vector<key_type> split_keys;
+
+    if(child->isLeaf()){
+        touch_leaf(child);
+        int n = child->size;
+        int k = (n + leaf_max_degree - 2) / (leaf_max_degree - 1);
+        int keep = n / k + (n % k > 0);
+        int start = keep;
+        for(int p = 1; p < k; p++){
+            int len = n / k + (p < n % k);
+            BPlusNode *leaf = new BPlusNode(true, len);
+            reserve_node(leaf);
+            leaf->last_access = child->last_access;
+            leaf->keys.assign(child->keys.begin() + start, child->keys.begin() + start + len);
+            leaf->values.assign(std::make_move_iterator(child->values.begin() + start),
+                                std::make_move_iterator(child->values.begin() + start + len));
+            split_keys.push_back(leaf->keys[0]);
+            pieces.push_back(leaf);
+            start += len;
+        }
+        // 链上新叶子
+        BPlusNode *prev = child;
+        for(auto leaf : pieces){
+            leaf->next_leaf = prev->next_leaf;
+            prev->next_leaf = leaf;
+            prev = leaf;
+        }
+        child->keys.resize(keep);
+        child->values.resize(keep);
+        child->size = keep;
+    }
+    else{
+        int n = child->size + 1;    // 按孩子数切分，相邻两段之间的索引提到父节点
+        int k = (n + nonleaf_max_degree - 1) / nonleaf_max_degree;
+        int keep = n / k + (n % k > 0);
+        int start = keep;
+        for(int p = 1; p < k; p++){
+            int len = n / k + (p < n % k);
+            BPlusNode *node = new BPlusNode(false, len - 1);
+            reserve_node(node);
+            split_keys.push_back(child->keys[start - 1]);
+            node->keys.assign(child->keys.begin() + start, child->keys.begin() + start + len - 1);
+            node->children.assign(child->children.begin() + start, child->children.begin() + start + len);
+            if(!child->buffer.empty()){     // 缓冲分区随孩子一起分走
+                node->buffer.assign(std::make_move_iterator(child->buffer.begin() + start),
+                                    std::make_move_iterator(child->buffer.begin() + start + len));
+                node->buffered = partition_total(node->buffer);
+                child->buffered -= node->buffered;
+            }
+            pieces.push_back(node);
+            start += len;
+        }
+        child->keys.resize(keep - 1);
+        child->children.resize(keep);
+        if(!child->buffer.empty())
+            child->buffer.resize(keep);
+        child->size = keep - 1;
+    }
+
+    parent->keys.insert(parent->keys.begin() + index, split_keys.begin(), split_keys.end());
+    parent->children.insert(parent->children.begin() + index + 1, pieces.begin(), pieces.end());
+    parent->size += pieces.size();
+    if(!parent->buffer.empty()){    // 父节点中这个孩子的分区按新的索引切开
+        parent->buffer.insert(parent->buffer.begin() + index + 1, pieces.size(), vector<Message>());
+        for(int p = (int)pieces.size() - 1; p >= 0; p--)
+            split_partition(parent->buffer[index], parent->buffer[index + 1 + p], split_keys[p]);
+    }
+    BPT_STAT_ADD(CNT_SPLITS, pieces.size());
+    return pieces.size();
+}
+
+// 把from分区中不小于split_key的消息移到空分区to中
+void BPlusTree::split_partition(vector<Message> &from, vector<Message> &to, const key_type &split_key)
+{
+    auto it = std::lower_bound(from.begin(), from.end(), split_key, message_less);
+    to.assign(std::make_move_iterator(it), std::make_move_iterator(from.end()));
+    from.erase(it, from.end());
+}
+
+// 调整根结点：超出上限则长高；内部根只剩一个孩子则变矮，其缓冲中的消息并入孩子；叶子根被删空则树为空
+void BPlusTree::fix_root()
+{
+    while(root){
+        int max_keys = root->isLeaf() ? leaf_max_degree - 1 : nonleaf_max_degree - 1;
+        if(root->size > max_keys){
+            BPlusNode *new_root = new BPlusNode(false, 0);
+            reserve_node(new_root);
+            new_root->children.push_back(root);
+            root = new_root;
+            split_child(root, 0);
+        }
+        else if(!root->isLeaf() && root->size == 0){
+            BPlusNode *old_root = root;
+            root = root->children[0];
+            if(!old_root->buffer.empty()){
+                vector<Message> &part = old_root->buffer[0];
+                if(root->isLeaf())
+                    apply_messages(root, part.data(), part.data() + part.size());
+                else
+                    merge_messages(root, part.data(), part.data() + part.size());
+            }
+            delete old_root;
+        }
+        else if(root->isLeaf() && root->size == 0){
+            delete root;
+            root = nullptr;
+        }
+        else
+            break;
+    }
+}
+
+// 写优化模式下的查找：自顶向下经过的缓冲中，越靠上的消息越新
+// 遇到的第一条插入/删除消息决定结果；修改消息只有在键存在时才生效，需要继续往下确认
+bool BPlusTree::buffered_search(const key_type &key, value_type &value)
+{
+    const value_type *updated = nullptr;
+    BPlusNode *p = root;
+    while(!p->isLeaf()){
+        int i = 0;
+        for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+
+        if(!p->buffer.empty()){
+            vector<Message> &part = p->buffer[i];
+            auto it = std::lower_bound(part.begin(), part.end(), key, message_less);
+            if(it != part.end() && BPlusNode::cmpKeys(it->key, key) == 0){
+                if(it->type == MSG_DELETE)
+                    return false;
+                if(it->type == MSG_PUT){
+                    value = updated ? *updated : it->value;
+                    return true;
+                }
+                if(!updated)
+                    updated = &it->value;
+            }
+        }
+        p = p->getChild(i);
+    }
+    BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+
+    int j = find_key_index(p, key);
+    if(j == p->getSize() || BPlusNode::cmpKeys(p->keys[j], key) != 0)
+        return false;
+    if(!updated)
+        touch_leaf(p);
+    value = updated ? *updated : p->values[j];
+    return true;
+}
+
+
+/*****************序列化与反序列化****************/
+// 从文件读入数据建树
+void BPlusTree::build_tree_from(string file_name)
+{
+    TierGuard tier_guard(tierer);
+    abort_restructure();
+    data_file = file_name;
+    if(hot_cache)
+        hot_cache->clear();
+    if(learned_index)
+        learned_index->invalidate();
+
+    from_file.open(file_name, std::ios::in);
+
+    // 文件存在
+    if(from_file.is_open()){    
+        // 文件不为空
+        if(from_file.peek() != std::fstream::traits_type::eof()) {
+            // 文件第一行为度数，内部节点度数不同时其后还有内部节点的度数
+            string line;
+            std::getline(from_file, line);
+            std::istringstream header(line);
+            int degree, nonleaf_degree;
+            header >> degree;
+            if(!(header >> nonleaf_degree))
+                nonleaf_degree = degree;
+            clear_tree();   // 原有的树整个换成文件中的
+            set_degrees(degree, nonleaf_degree);
+
+            last_leaf = nullptr;
+            root = deserializeNodeFromFile();
+            cout << "Successfully deserialized and built a B-plus tree from file: " << file_name << endl;  
+        } 
+        else
+            cout << "Failed to deserialize: The file is empty." << endl;
+    }
+    else
+        cout << "Failed to deserialize: The file does't exist." << endl;
+        
+
+    from_file.close();
+    cout << "Degree of the tree: " << leaf_max_degree << endl;
+}
+
+void BPlusTree::save_to_file()
+{
+    TierGuard tier_guard(tierer);
+    flush_all();    // 文件中只保存叶子上的数据
+    to_file.open(data_file);
+
+    // 树不为空
+    if(root){
+        // 文件第一行写入度
+        to_file << leaf_max_degree;
+        if(nonleaf_max_degree != leaf_max_degree)
+            to_file << ' ' << nonleaf_max_degree;
+        to_file << '\n';
+        serializeNodeToFile(root, to_file);
+    }
+        
+
+    cout << "Updation saved to file." << endl;
+    to_file.close();
+}
+
+// 同上，但序列化的结果按大块交给异步I/O写出，写盘与序列化重叠
+bool BPlusTree::save_to_file(AsyncIO &io)
+{
+    TierGuard tier_guard(tierer);
+    flush_all();
+    int fd = ::open(data_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        std::cerr << "Error: save to file failed: cannot open '" << data_file << "'!" << endl;
+        return false;
+    }
+    bool ok;
+    {
+        AsyncFileWriter writer(io, fd);
+        std::ostream out(&writer);
+        if(root){
+            out << leaf_max_degree;
+            if(nonleaf_max_degree != leaf_max_degree)
+                out << ' ' << nonleaf_max_degree;
+            out << '\n';
+            serializeNodeToFile(root, out);
+        }
+        out.flush();
+        ok = writer.finish();
+    }
+    ::close(fd);
+    if(!ok){
+        std::cerr << "Error: save to file failed: write to '" << data_file << "' failed!" << endl;
+        return false;
+    }
+    cout << "Updation saved to file." << endl;
+    return true;
+}
+
+// 序列化B+树到文件
+void BPlusTree::serializeNodeToFile(BPlusNode* node, std::ostream &out)
+{
+    // if(node == nullptr){
+    //     cout << "function: serializeNodeToFile: failed, node is nullptr" << endl;
+    //     return;
+    // }
+
+    // 第一行：是否叶子节点     第二行：节点大小
+    int is_leaf = node->isLeaf() ? 1 : 0;
+    out << is_leaf << '\n' << node->getSize() << '\n';
+    // 第三行：keys 
+    for(auto key : node->keys)
+        out << key << " ";
+    out << '\n';
+    // 判断是否是叶子节点      
+    if(is_leaf){    //  是，第四行写valus；冷叶子解出一份副本来写，不放回叶子
+        vector<value_type> cold_values;
+        if(node->cold && !read_cold_values(node, cold_values))
+            cold_values.resize(node->size);
+        for(auto value : node->cold ? cold_values : node->values)
+            out << value << " ";
+        out << '\n';
+    }
+    else{   // 不是：递归写入孩子节点
+        for(auto child : node->children)
+            serializeNodeToFile(child, out);
+    }
+}
+
+// 从文件反序列化B+树到内存
+BPlusNode* BPlusTree::deserializeNodeFromFile()
+{
+    BPlusNode *node = new BPlusNode();
+
+    int is_leaf, size;
+    from_file >> is_leaf >> size;
+    if(is_leaf)
+        node->leaf = true;
+    else    
+        node->leaf = false;
+    node->size = size;
+    reserve_node(node);
+
+    int key;
+    for(int i = 0; i < size; i++){
+        from_file >> key;
+        node->keys.push_back(key);
     }
 
     // 是叶节点：读入values
@@ -589,6 +2372,9 @@ BPlusNode* BPlusTree::deserializeNodeFromFile()
     else{
         for(int i = 0; i <= size; i++)
             node->children.push_back(deserializeNodeFromFile());
+        if(order_stats)
+            for(auto child : node->children)
+                node->counts.push_back(subtree_count(child));
     }
 
     return node;
@@ -599,33 +2385,26 @@ BPlusNode* BPlusTree::deserializeNodeFromFile()
 // 清空树，释放每一个节点的内存
 void BPlusTree::clear_tree()
 {
+    TierGuard tier_guard(tierer);
+    abort_restructure();
     if(!root)
         return;
 
-    std::queue<BPlusNode*> Q;
-    BPlusNode *p = nullptr;
-    Q.push(root);
-
-    while(!Q.empty()){
-        p = Q.front();
-        Q.pop();
-
-        // 是内部节点，将孩子加入队列等待删除
-        if(!p->isLeaf())
-            for(int i = 0; i < p->getSize()+1; i++)
-                Q.push(p->getChild(i));
-
-        // 释放当前节点内存
-        delete p;
-    }
+    free_subtree(root);
 
     root = nullptr;
+    buffered_messages = 0;
+    if(hot_cache)
+        hot_cache->clear();
+    if(learned_index)
+        learned_index->invalidate();
     cout << "Deleted the whole tree and freed all the space." << endl;
 }
 
 // 验证当前树是否是B+树
 bool BPlusTree::is_bplustree()
 {
+    flush_all();
     if(!root)
         return true;
 
@@ -634,7 +2413,7 @@ bool BPlusTree::is_bplustree()
         node = node->getChild(0);
 
     int i = 0;
-    while(node->next_leaf==nullptr || i < node->getSize()-1){
+    while(node->next_leaf != nullptr || i < node->getSize()-1){
         if(i < node->getSize()-1){
             if(BPlusNode::cmpKeys(node->getKey(i), node->getKey(i+1)) >= 0)
                 return false;
@@ -659,9 +2438,592 @@ void BPlusTree::verify()
         cout << "Verification failed, it is not a B+ tree. " << endl;
 }
 
+/***************** 统计 ****************/
+// 获取统计快照（进程内所有线程、所有树的累计值，需以 BPT_ENABLE_STATS 编译）
+StatsSnapshot BPlusTree::getStats()
+{
+    return stats::snapshot();
+}
+
+// 重置统计
+void BPlusTree::resetStats()
+{
+    stats::reset();
+}
+
+/***************** 轨迹记录 ****************/
+// 设置轨迹记录器，传入nullptr则停止记录；记录器的生命周期由调用者管理
+void BPlusTree::set_recorder(TraceRecorder *rec)
+{
+    recorder = rec;
+}
+
+/***************** 热点键缓存 ****************/
+// 开启热点键缓存，entries为槽数（向上取整），传入0则关闭；重新开启时原有的缓存内容丢弃
+// 缓存保存value的副本，叶子中条目的搬动（分裂、借、合并）不影响它，只有改写value和删除键时需要同步
+void BPlusTree::enable_hot_cache(size_t entries)
+{
+    delete hot_cache;
+    hot_cache = entries > 0 ? new HotCache(entries) : nullptr;
+}
+
+// 缓存的命中率与内存占用，未开启时各项均为0
+HotCacheStats BPlusTree::getHotCacheStats()
+{
+    return hot_cache ? hot_cache->getStats() : HotCacheStats();
+}
+
+void BPlusTree::resetHotCacheStats()
+{
+    if(hot_cache)
+        hot_cache->resetStats();
+}
+
+/***************** 学习索引 ****************/
+// 开启学习索引并按当前的叶子训练，epsilon为预测叶子序号的最大误差，传入<=0则关闭
+bool BPlusTree::enable_learned_index(int epsilon)
+{
+    if(epsilon > 0 && write_optimized){
+        cout << "Failed to enable learned index: write-optimized mode is on!" << endl;
+        return false;
+    }
+    delete learned_index;
+    learned_index = nullptr;
+    if(epsilon > 0){
+        learned_index = new LearnedIndex(epsilon);
+        retrain_learned_index();
+    }
+    return true;
+}
+
+// 按当前的树重新训练
+void BPlusTree::retrain_learned_index()
+{
+    if(learned_index)
+        learned_index->train(root);
+}
+
+// 由模型定位key所在的叶子，欠账过多时先重新训练；返回nullptr表示需要从根下降
+BPlusNode *BPlusTree::learned_leaf(const key_type &key)
+{
+    if(learned_index->needsRetrain())
+        retrain_learned_index();
+    BPlusNode *p = learned_index->findLeaf(key);
+    if(p)
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+    return p;
+}
+
+// 子树中内部节点占用的内存
+size_t BPlusTree::inner_node_bytes(BPlusNode *node)
+{
+    if(node == nullptr || node->isLeaf())
+        return 0;
+    size_t bytes = sizeof(BPlusNode) + node->keys.capacity() * sizeof(key_type)
+                 + node->children.capacity() * sizeof(BPlusNode*) + node->counts.capacity() * sizeof(int);
+    for(auto child : node->children)
+        bytes += inner_node_bytes(child);
+    return bytes;
+}
+
+// 模型的规模、内存（与内部节点对比）以及查找走各条路径的次数，未开启时各项均为0
+LearnedIndexStats BPlusTree::getLearnedIndexStats()
+{
+    if(!learned_index)
+        return LearnedIndexStats();
+    LearnedIndexStats s = learned_index->getStats();
+    s.inner_bytes = inner_node_bytes(root);
+    return s;
+}
+
+
+/***************** 在线重建 ****************/
+// 设置两种节点的度数及相应的下限，不改动已有的节点
+void BPlusTree::apply_degrees(int leaf_degree, int nonleaf_degree)
+{
+    leaf_max_degree = leaf_degree;
+    leaf_min_degree = (leaf_max_degree+1)/2;
+    nonleaf_max_degree = nonleaf_degree;
+    nonleaf_min_degree = (nonleaf_max_degree+1)/2;
+}
+
+// 开始把树重建成新的度数：只建立重建状态，之后由restructure_step分步复制，finish_restructure换根
+// 进行中的重建被放弃；树为空时直接改度数
+bool BPlusTree::begin_restructure(int leaf_degree, int nonleaf_degree)
+{
+    TierGuard tier_guard(tierer);
+    if(leaf_degree < 3 || nonleaf_degree < 3){
+        cout << "Failed to restructure: degree must be at least 3!" << endl;
+        return false;
+    }
+    abort_restructure();
+    if(!root){
+        apply_degrees(leaf_degree, nonleaf_degree);
+        return true;
+    }
+    if(write_optimized)     // 复制只读叶子，开始前缓冲的消息先作用下去；之后的修改都记在日志中
+        flush_all();
+    restructure = new Restructure(leaf_degree, nonleaf_degree);
+    return true;
+}
+
+// 从游标处往后复制至多max_leaves个叶子到新树，返回是否已复制完
+// 只读旧树，不改动旧树的任何节点，两步之间旧树照常服务读写
+bool BPlusTree::restructure_step(int max_leaves)
+{
+    TierGuard tier_guard(tierer);
+    if(!restructure || restructure->stats.copied)
+        return true;
+    Restructure &r = *restructure;
+    r.stats.steps++;
+
+    // 从游标处重新下降：遇到等于游标的索引键往左走，落到可能含有游标的最左边的叶子
+    BPlusNode *p = root;
+    while(p && !p->isLeaf()){
+        int i = 0;
+        if(r.started)
+            for(; i < p->size && BPlusNode::cmpKeys(r.cursor, p->keys[i]) > 0; i++);
+        p = p->children[i];
+    }
+
+    int copied = 0;
+    bool any = false;
+    key_type last = 0;
+    vector<value_type> cold_values;
+    for(; p; p = p->next_leaf){
+        // 复制够一批后在叶子边界停下，但不把一串相同的键拆到两步中
+        if(copied >= max_leaves && any && p->size > 0 && BPlusNode::cmpKeys(p->keys[0], last) > 0)
+            break;
+        if(p->cold && !read_cold_values(p, cold_values))    // 冷叶子解出一份副本，不放回叶子
+            cold_values.assign(p->size, value_type());
+        const vector<value_type> &values = p->cold ? cold_values : p->values;
+        for(int j = r.started ? find_key_index(p, r.cursor) : 0; j < p->size; j++){
+            BPlusNode *leaf = r.builder.add(p->keys[j], values[j]);
+            leaf->last_access = std::max(leaf->last_access, p->last_access);
+            last = p->keys[j];
+            any = true;
+            r.stats.keys_copied++;
+        }
+        copied++;
+    }
+    r.stats.leaves_copied += copied;
+    r.started = true;
+    if(p)
+        r.cursor = p->keys[0];
+    else
+        r.stats.copied = true;
+    return r.stats.copied;
+}
+
+// 复制完后换根：先按旧树改正重建期间被修改过的区间，再把新树换上；旧树交给后台线程释放，不占用换根的时间
+bool BPlusTree::finish_restructure()
+{
+    TierGuard tier_guard(tierer);
+    if(!restructure || !restructure->stats.copied){
+        std::cerr << "Error: finish restructure failed: " << (restructure ? "copying is not done!" : "no restructure in progress!") << endl;
+        return false;
+    }
+    Restructure *r = restructure;
+    restructure = nullptr;      // 之后的改正不再记日志
+    if(write_optimized)
+        flush_all();
+
+    BPlusTree next;
+    next.apply_degrees(r->stats.leaf_degree, r->stats.nonleaf_degree);
+    next.root = r->builder.finish();
+
+    // 合并重叠、相邻的区间；每个区间先删掉新树中的键，再按旧树现在的内容写回
+    auto &ranges = r->touched;
+    std::sort(ranges.begin(), ranges.end());
+    vector<std::pair<key_type, key_type>> merged;
+    for(auto &range : ranges){
+        if(!merged.empty() && (long long)range.first <= (long long)merged.back().second + 1)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    vector<std::pair<key_type, value_type>> entries;
+    for(auto &range : merged){
+        if(next.root)
+            next.deleteRange(range.first, range.second);
+        entries.clear();
+        scanBlocks(range.first, range.second, [&](const LeafSpan &span){
+            for(int i = 0; i < span.size; i++)
+                entries.emplace_back(span.keys[i], span.values[i]);
+            return true;
+        });
+        for(auto it = entries.rbegin(); it != entries.rend(); ++it)     // 倒序插入，相同的键保持原来的先后
+            next.insertKeyValue(it->first, it->second);
+        r->stats.repaired_keys += entries.size();
+    }
+
+    BPlusNode *old_root = root;
+    root = next.root;
+    next.root = nullptr;
+    apply_degrees(r->stats.leaf_degree, r->stats.nonleaf_degree);
+    if(old_root)
+        retire_subtree(old_root);
+    buffered_messages = 0;
+    if(order_stats && root)
+        build_counts(root);
+    if(learned_index)
+        learned_index->invalidate();
+
+    r->stats.active = false;
+    last_restructure = r->stats;
+    delete r;
+    return true;
+}
+
+// 换根后旧树已没有任何指针能到达，释放它只是逐个delete节点，放到后台线程中做；上一棵还没释放完时先等它
+void BPlusTree::retire_subtree(BPlusNode *node)
+{
+    if(reclaimer.joinable())
+        reclaimer.join();
+    reclaimer = std::thread([this, node]{ free_subtree(node); });
+}
+
+// 放弃进行中的重建，已复制的新节点全部释放
+void BPlusTree::abort_restructure()
+{
+    delete restructure;
+    restructure = nullptr;
+}
+
+bool BPlusTree::restructuring()
+{
+    return restructure != nullptr;
+}
+
+// 进行中的重建的进度，没有则为最近一次完成的
+RestructureStats BPlusTree::getRestructureStats()
+{
+    return restructure ? restructure->stats : last_restructure;
+}
+
+// 重建期间修改了[lo, hi]内的键：记下区间，换根前以旧树为准改正
+void BPlusTree::note_write(const key_type &lo, const key_type &hi)
+{
+    if(restructure && BPlusNode::cmpKeys(lo, hi) <= 0){
+        restructure->touched.emplace_back(lo, hi);
+        restructure->stats.logged_ranges++;
+    }
+}
+
+/***************** 成批修改 ****************/
+// 把按键排好序的一批操作作用到树上，结果写回各操作，返回从根下降的次数（退回单个操作路径的每个操作各算一次）
+// 落在同一个叶子上的一串操作只下降一次；会引起分裂、下溢或改索引的那个操作退回单个操作的路径执行，之后重新下降
+int BPlusTree::applyBatch(CombinedOp **first, CombinedOp **last)
+{
+    BPT_STAT_TIMER(OP_BATCH);
+    TierGuard tier_guard(tierer);
+    int descents = 0;
+    CombinedOp **it = first;
+    while(it != last){
+        // 写优化模式下修改走缓冲路径；空树由单个操作建根
+        if(write_optimized || !root){
+            apply_single(**it);
+            descents++;
+            ++it;
+            continue;
+        }
+
+        // 下降到第一个操作所在的叶子，同时记下叶子的上界：路径上离叶子最近的、在右边的索引键
+        TreePath path;
+        BPlusNode *p = root;
+        bool bounded = false;
+        key_type bound = 0;
+        key_type key = (*it)->key;
+        while(!p->isLeaf()){
+            int i = 0;
+            for(; i < p->getSize() && BPlusNode::cmpKeys(key, p->getKey(i)) >= 0; i++);
+            BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+            BPT_STAT_ADD(CNT_KEYS_COMPARED, i < p->getSize() ? i+1 : i);
+            if(i < p->getSize()){
+                bounded = true;
+                bound = p->getKey(i);
+            }
+            path.push(p, i);
+            p = p->getChild(i);
+        }
+        BPT_STAT_ADD(CNT_NODES_VISITED, 1);
+        descents++;
+        touch_leaf(p);
+
+        // 依次作用键小于上界的操作，遇到要改树结构的就停下
+        bool structural = false;
+        CombinedOp **leaf_first = it;
+        for(; it != last && (!bounded || BPlusNode::cmpKeys((*it)->key, bound) < 0); ++it){
+            CombinedOp &op = **it;
+            int j = find_key_index(p, op.key);
+            bool exists = j < p->size && BPlusNode::cmpKeys(p->keys[j], op.key) == 0;
+            if(op.type == CMB_SEARCH){
+                if(recorder)
+                    recorder->record(TRACE_SEARCH, op.key);
+                op.result = exists;
+                if(exists){
+                    *op.out = p->values[j];
+                    if(hot_cache)
+                        hot_cache->admit(op.key, *op.out);
+                }
+                else
+                    std::cerr << "Error: search failed: key '" << op.key << "' desn't exist!" << endl;
+                continue;
+            }
+            if(op.type == CMB_UPSERT && exists){
+                if(recorder)
+                    recorder->record(TRACE_UPSERT, op.key, op.value);
+                note_write(op.key, op.key);
+                p->values[j] = *op.value;
+                if(hot_cache)
+                    hot_cache->update(op.key, p->values[j]);
+                op.result = false;
+                continue;
+            }
+            if(op.type == CMB_DELETE && !exists){
+                if(recorder)
+                    recorder->record(TRACE_DELETE, op.key);
+                std::cerr << "Error: delete failed: key '" << op.key << "' doesn't exist!" << endl;
+                op.result = false;
+                continue;
+            }
+            // 插入会使叶子满到要分裂，删除会使叶子下溢或删掉最小键：交给单个操作
+            if(op.type == CMB_DELETE ? (p != root && (j == 0 || p->size <= leaf_min_degree-1)) || p->size == 1
+                                     : p->size + 1 >= leaf_max_degree){
+                structural = true;
+                break;
+            }
+            if(op.type == CMB_DELETE){
+                if(recorder)
+                    recorder->record(TRACE_DELETE, op.key);
+                note_write(op.key, op.key);
+                p->keys.erase(p->keys.begin()+j);
+                p->values.erase(p->values.begin()+j);
+                p->size--;
+                if(hot_cache)
+                    hot_cache->invalidate(op.key);
+            }
+            else{   // 插入，或插入或覆盖时键不存在：新插入的排在相同的键前面，与insert_into_leaf一致
+                if(recorder)
+                    recorder->record(op.type == CMB_INSERT ? TRACE_INSERT : TRACE_UPSERT, op.key, op.value);
+                note_write(op.key, op.key);
+                p->keys.insert(p->keys.begin()+j, op.key);
+                p->values.insert(p->values.begin()+j, *op.value);
+                p->size++;
+                if(hot_cache)
+                    hot_cache->invalidate(op.key);
+            }
+            if(order_stats)
+                for(int d = 0; d < path.depth; d++)
+                    path.nodes[d]->counts[path.slots[d]] += op.type == CMB_DELETE ? -1 : 1;
+            op.result = true;
+        }
+        BPT_STAT_ADD(CNT_BATCHED_OPS, it - leaf_first);
+        if(structural){
+            apply_single(**it);
+            descents++;
+            ++it;
+        }
+    }
+    return descents;
+}
+
+// 按单个操作的路径执行一个操作
+void BPlusTree::apply_single(CombinedOp &op)
+{
+    switch(op.type){
+    case CMB_INSERT:
+        op.result = insertKeyValue(op.key, *op.value);
+        break;
+    case CMB_UPSERT:
+        op.result = upsert(op.key, *op.value);
+        break;
+    case CMB_DELETE:
+        op.result = deleteKeyValue(op.key);
+        break;
+    case CMB_SEARCH:
+        op.result = searchKeyValue(op.key, *op.out);
+        break;
+    }
+}
+
+/***************** 冷热分层 ****************/
+// 开启冷热分层；config.interval_ms大于0时由后台线程定期扫描，否则只在调用tier_cold_leaves时扫描
+bool BPlusTree::enable_tiering(const TieringConfig &config)
+{
+    if(config.cold_epochs <= 0 || config.batch_leaves <= 0){
+        cout << "Failed to enable tiering: cold_epochs and batch_leaves must be positive!" << endl;
+        return false;
+    }
+    Tierer *t = new Tierer(config, [this]{
+        int frozen;
+        return tier_step(tierer->config.batch_leaves, frozen);
+    });
+    if(!config.spill_file.empty() && !t->spill){
+        cout << "Failed to enable tiering: cannot open spill file " << config.spill_file << "!" << endl;
+        delete t;
+        return false;
+    }
+    delete tierer;
+    tierer = t;
+    tierer->start();
+    return true;
+}
+
+// 关闭冷热分层：停掉后台线程，把所有冷叶子解压回来
+void BPlusTree::disable_tiering()
+{
+    delete tierer;
+    tierer = nullptr;
+    if(!root)
+        return;
+    BPlusNode *p = root;
+    while(!p->isLeaf())
+        p = p->children[0];
+    for(; p; p = p->next_leaf)
+        if(p->cold)
+            thaw_leaf(p);
+}
+
+// 立即从头扫描一遍并进入下一个周期，返回压缩的叶子数
+int BPlusTree::tier_cold_leaves()
+{
+    if(!tierer)
+        return 0;
+    TierGuard tier_guard(tierer);
+    int frozen;
+    tierer->hand_valid = false;
+    tier_step(std::numeric_limits<int>::max(), frozen);
+    return frozen;
+}
+
+// 从上一批停下的叶子开始检查至多max_leaves个叶子，压缩其中的冷叶子；扫到叶子链表末尾时进入下一个周期并返回true
+// 停下的位置记为那个叶子的最小键而不是指针，两批之间叶子可能被合并释放
+bool BPlusTree::tier_step(int max_leaves, int &frozen)
+{
+    frozen = 0;
+    BPlusNode *p = root;
+    if(p && tierer->hand_valid)
+        p = leaf_for(root, tierer->hand);
+    else if(p){
+        while(!p->isLeaf())
+            p = p->children[0];
+    }
+    for(int n = 0; p && n < max_leaves; n++, p = p->next_leaf){
+        if(!p->cold && p->size > 0 && tierer->isCold(p->last_access)){
+            freeze_leaf(p);
+            frozen++;
+        }
+    }
+    if(p && p->size > 0){
+        tierer->hand = p->keys[0];
+        tierer->hand_valid = true;
+        return false;
+    }
+    tierer->hand_valid = false;
+    tierer->epoch++;
+    tierer->sweeps++;
+    return true;
+}
+
+// 读写叶子的value之前调用：冷叶子先解压，并记下访问的周期
+void BPlusTree::touch_leaf(BPlusNode *leaf)
+{
+    if(leaf->cold)
+        thaw_leaf(leaf);
+    if(tierer)
+        leaf->last_access = tierer->epoch;
+}
+
+// 压缩叶子的values，有溢出文件时写入文件，内存中只留位置
+void BPlusTree::freeze_leaf(BPlusNode *leaf)
+{
+    ColdLeaf *cold = new ColdLeaf();
+    encode_values(leaf->values, leaf->size, cold->data);
+    for(int i = 0; i < leaf->size; i++)
+        cold->raw_bytes += leaf->values[i].size();
+    cold->length = cold->data.size();
+    if(tierer->spill && tierer->spill->write(cold->data, cold->offset)){
+        cold->file = tierer->spill;
+        string().swap(cold->data);
+    }
+    else
+        cold->data.shrink_to_fit();
+    vector<value_type>().swap(leaf->values);
+    leaf->cold = cold;
+    tierer->freezes++;
+}
+
+// 解压冷叶子的values放回叶子；读溢出文件失败时value丢失，以空串占位保持键值对齐
+void BPlusTree::thaw_leaf(BPlusNode *leaf)
+{
+    vector<value_type> values;
+    values.reserve(std::max(leaf_max_degree, leaf->size));
+    if(!read_cold_values(leaf, values)){
+        std::cerr << "Error: thaw failed: values of a cold leaf are lost!" << endl;
+        values.resize(leaf->size);
+    }
+    leaf->values.swap(values);
+    delete leaf->cold;
+    leaf->cold = nullptr;
+    if(tierer)
+        tierer->thaws++;
+}
 
+// 解出冷叶子的values，不改动叶子
+bool BPlusTree::read_cold_values(BPlusNode *leaf, vector<value_type> &values)
+{
+    ColdLeaf *cold = leaf->cold;
+    if(cold->file){
+        string data;
+        return cold->file->read(cold->offset, cold->length, data) && decode_values(data, leaf->size, values);
+    }
+    return decode_values(cold->data, leaf->size, values);
+}
 
+// 常驻内存与压缩部分的占用；未开启分层时也可调用，此时所有叶子都未压缩
+TierStats BPlusTree::getTierStats()
+{
+    TierGuard tier_guard(tierer);
+    TierStats s;
+    if(tierer){
+        s.freezes = tierer->freezes;
+        s.thaws = tierer->thaws;
+        s.sweeps = tierer->sweeps;
+        if(tierer->spill){
+            s.spilled_bytes = tierer->spill->size();
+            s.spilled_live_bytes = tierer->spill->liveBytes();
+        }
+    }
+    s.inner_bytes = inner_node_bytes(root);
+    if(!root)
+        return s;
 
+    BPlusNode *p = root;
+    while(!p->isLeaf())
+        p = p->children[0];
+    for(; p; p = p->next_leaf){
+        s.leaves++;
+        size_t bytes = sizeof(BPlusNode) + p->keys.capacity() * sizeof(key_type);
+        if(p->cold){
+            s.cold_leaves++;
+            if(p->cold->file)
+                s.spilled_leaves++;
+            s.cold_bytes += bytes + sizeof(ColdLeaf) + p->cold->data.capacity();
+            s.cold_raw_bytes += p->cold->raw_bytes;
+            continue;
+        }
+        bytes += p->values.capacity() * sizeof(value_type);
+        for(auto &v : p->values){
+            // value超出短字符串优化的长度时另有堆内存
+            const char *data = v.data();
+            if(data < (const char *)&v || data >= (const char *)(&v + 1))
+                bytes += v.capacity() + 1;
+        }
+        s.hot_bytes += bytes;
+    }
+    return s;
+}
 
 // 层次遍历打印
 void printBPT(BPlusNode* root)
@@ -0,0 +1,184 @@
+#include "workload.h"
+#include <cmath>
+
+const char *workloadOpName(WorkloadOp op)
+{
+    static const char *names[WOP_COUNT] = {"read", "update", "insert", "scan", "delete", "rmw"};
+    return names[op];
+}
+
+const char *distributionName(KeyDistribution dist)
+{
+    static const char *names[] = {"uniform", "zipfian", "sequential", "latest"};
+    return names[dist];
+}
+
+/*******************    Zipf分布     *********************/
+static double zeta(uint64_t from, uint64_t to, double theta)
+{
+    double sum = 0;
+    for(uint64_t i = from; i < to; i++)
+        sum += 1.0 / std::pow((double)(i + 1), theta);
+    return sum;
+}
+
+ZipfianGenerator::ZipfianGenerator(uint64_t items, double theta): items(items), theta(theta)
+{
+    alpha = 1.0 / (1.0 - theta);
+    zeta2 = zeta(0, 2, theta);
+    zetan = zeta(0, items, theta);
+    update_eta();
+}
+
+void ZipfianGenerator::update_eta()
+{
+    eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+}
+
+void ZipfianGenerator::grow(uint64_t new_items)
+{
+    if(new_items <= items)
+        return;
+    zetan += zeta(items, new_items, theta);
+    items = new_items;
+    update_eta();
+}
+
+uint64_t ZipfianGenerator::next(std::mt19937_64 &rng)
+{
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zetan;
+    if(uz < 1.0)
+        return 0;
+    if(uz < 1.0 + std::pow(0.5, theta))
+        return 1;
+    uint64_t ret = (uint64_t)(items * std::pow(eta * u - eta + 1, alpha));
+    return ret < items ? ret : items - 1;
+}
+
+/*******************    键选择     *********************/
+// FNV-1a 64位哈希，用于打散Zipf热点
+static uint64_t fnv_hash(uint64_t v)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < 8; i++){
+        h ^= v & 0xff;
+        h *= 0x100000001b3ULL;
+        v >>= 8;
+    }
+    return h;
+}
+
+KeyChooser::KeyChooser(KeyDistribution dist, uint64_t items, uint64_t seed):
+        dist(dist), rng(seed), zipf(items > 2 ? items : 2){}
+
+uint64_t KeyChooser::next(uint64_t items)
+{
+    switch(dist){
+    case DIST_UNIFORM:
+        return std::uniform_int_distribution<uint64_t>(0, items - 1)(rng);
+    case DIST_ZIPFIAN:
+        zipf.grow(items);
+        return fnv_hash(zipf.next(rng)) % items;
+    case DIST_SEQUENTIAL:
+        return cursor++ % items;
+    case DIST_LATEST:
+    default:
+        zipf.grow(items);
+        return items - 1 - zipf.next(rng) % items;
+    }
+}
+
+/*******************    负载描述     *********************/
+bool WorkloadSpec::byName(const string &name, WorkloadSpec &spec)
+{
+    spec = WorkloadSpec();
+    spec.name = name;
+    if(name == "A"){            // 更新密集
+        spec.proportion[WOP_READ] = 0.5;
+        spec.proportion[WOP_UPDATE] = 0.5;
+    }
+    else if(name == "B"){       // 读为主
+        spec.proportion[WOP_READ] = 0.95;
+        spec.proportion[WOP_UPDATE] = 0.05;
+    }
+    else if(name == "C"){       // 只读
+        spec.proportion[WOP_READ] = 1.0;
+    }
+    else if(name == "D"){       // 读最新
+        spec.proportion[WOP_READ] = 0.95;
+        spec.proportion[WOP_INSERT] = 0.05;
+        spec.dist = DIST_LATEST;
+    }
+    else if(name == "E"){       // 短范围扫描
+        spec.proportion[WOP_SCAN] = 0.95;
+        spec.proportion[WOP_INSERT] = 0.05;
+    }
+    else if(name == "F"){       // 读-改-写
+        spec.proportion[WOP_READ] = 0.5;
+        spec.proportion[WOP_RMW] = 0.5;
+    }
+    else if(name == "churn"){   // 滑动窗口：新键插入、老键删除
+        spec.proportion[WOP_READ] = 0.5;
+        spec.proportion[WOP_INSERT] = 0.25;
+        spec.proportion[WOP_DELETE] = 0.25;
+        spec.dist = DIST_UNIFORM;
+    }
+    else
+        return false;
+    return true;
+}
+
+/*******************    负载实例     *********************/
+Workload::Workload(const WorkloadSpec &spec, uint64_t record_count, uint64_t seed):
+        spec(spec), rng(seed), chooser(spec.dist, record_count, seed + 1), insert_count(record_count)
+{
+    load_order.resize(record_count);
+    for(uint64_t i = 0; i < record_count; i++)
+        load_order[i] = (key_type)(i + 1);
+    std::shuffle(load_order.begin(), load_order.end(), rng);
+}
+
+key_type Workload::loadKey(uint64_t i)
+{
+    return load_order[i];
+}
+
+uint64_t Workload::liveCount()
+{
+    return insert_count - delete_count;
+}
+
+WorkloadOp Workload::nextOp()
+{
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    for(int op = 0; op < WOP_COUNT; op++){
+        if(u < spec.proportion[op])
+            return (WorkloadOp)op;
+        u -= spec.proportion[op];
+    }
+    return WOP_READ;
+}
+
+key_type Workload::nextReadKey()
+{
+    return (key_type)(delete_count + chooser.next(liveCount()) + 1);
+}
+
+key_type Workload::nextInsertKey()
+{
+    return (key_type)(++insert_count);
+}
+
+key_type Workload::nextDeleteKey()
+{
+    // 只剩一条记录时调用者应改发别的操作；仍被调用时返回一个已不存在的键（最近删除的键，或从未插入过的0），不删掉最后一条
+    if(liveCount() <= 1)
+        return (key_type)delete_count;
+    return (key_type)(++delete_count);
+}
+
+int Workload::nextScanLength()
+{
+    return std::uniform_int_distribution<int>(1, spec.max_scan_length)(rng);
+}